@@ -0,0 +1,690 @@
+// takyon_bench: micro-benchmarks for nodes, the render callback, graph
+// maintenance, voice allocation and Lua binding calls.
+//
+//   takyon_bench [--format csv|json] [--quick] [--filter <substring>]
+//                [--threads N]
+//
+// Results go to stdout, one row per measurement; progress goes to stderr so
+// the output can be redirected straight into a file and diffed or plotted
+// across releases.
+
+#include "audio.h"
+#include "graph.h"
+#include "lua_bindings.h"
+#include "mix.h"
+#include "nodes.h"
+#include "rate.h"
+#include "voice.h"
+#include "wavetable.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <lauxlib.h>
+#include <lualib.h>
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Result {
+  std::string suite; // nodes, callback, graph, voice, lua
+  std::string name;
+  long size;         // graph size or partial count; 0 when not applicable
+  double value;
+  std::string unit;
+};
+
+struct Options {
+  bool json = false;
+  bool quick = false;
+  std::string filter;
+  int threads = 0; // render helper threads for the callback suite
+};
+
+Options options;
+std::vector<Result> results;
+
+double elapsedNs(Clock::time_point start) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start)
+      .count();
+}
+
+bool selected(const std::string &suite, const std::string &name) {
+  return options.filter.empty() ||
+         (suite + "/" + name).find(options.filter) != std::string::npos;
+}
+
+void report(const std::string &suite, const std::string &name, long size,
+            double value, const std::string &unit) {
+  results.push_back({suite, name, size, value, unit});
+  std::cerr << suite << "/" << name;
+  if (size)
+    std::cerr << " [" << size << "]";
+  std::cerr << ": " << value << " " << unit << std::endl;
+}
+
+// Median of `repeats` runs of `body`, each timed over `iterations` calls.
+double medianNs(int repeats, long iterations,
+                const std::function<void()> &body) {
+  std::vector<double> runs;
+  for (int r = 0; r < repeats; r++) {
+    auto start = Clock::now();
+    for (long i = 0; i < iterations; i++)
+      body();
+    runs.push_back(elapsedNs(start) / iterations);
+  }
+  std::sort(runs.begin(), runs.end());
+  return runs[runs.size() / 2];
+}
+
+// Per-call latency percentiles over `samples` individually timed calls.
+struct Percentiles {
+  double p50, p99, max;
+};
+
+Percentiles percentiles(std::vector<double> &samples) {
+  std::sort(samples.begin(), samples.end());
+  auto at = [&](double q) {
+    return samples[std::min(samples.size() - 1,
+                            static_cast<size_t>(q * samples.size()))];
+  };
+  return {at(0.5), at(0.99), samples.back()};
+}
+
+// Node construction without the console chatter of the Lua-facing init().
+std::unique_ptr<Oscillator> makeOscillator(float freq, Waveform type) {
+  auto osc = std::make_unique<Oscillator>();
+  osc->amp.set(0.1f);
+  osc->freq.set(freq);
+  osc->type = type;
+  return osc;
+}
+
+std::unique_ptr<LFO> makeLFO(float base, float amp, float freq,
+                             Waveform type) {
+  auto lfo = std::make_unique<LFO>();
+  lfo->base.set(base);
+  lfo->amp.set(amp);
+  lfo->freq.set(freq);
+  lfo->type = type;
+  return lfo;
+}
+
+std::unique_ptr<OscillatorBank> makeBank(int count, Waveform type) {
+  auto bank = std::make_unique<OscillatorBank>();
+  bank->amp.set(0.1f);
+  bank->freq.set(110.0f);
+  bank->count.store(count);
+  bank->spread.store(20.0f);
+  bank->type = type;
+  bank->configure();
+  return bank;
+}
+
+std::unique_ptr<Filter> makeFilter(float cutoff, float q) {
+  auto filter = std::make_unique<Filter>();
+  filter->cutoff.set(cutoff);
+  filter->q.set(q);
+  return filter;
+}
+
+const char *waveformName(Waveform type) {
+  switch (type) {
+  case Waveform::Sine:
+    return "sine";
+  case Waveform::Saw:
+    return "saw";
+  case Waveform::InvSaw:
+    return "invsaw";
+  case Waveform::Square:
+    return "square";
+  case Waveform::Triangle:
+    return "triangle";
+  }
+  return "?";
+}
+
+const Waveform WAVEFORMS[] = {Waveform::Sine, Waveform::Saw, Waveform::InvSaw,
+                              Waveform::Square, Waveform::Triangle};
+
+// --- nodes ------------------------------------------------------------------
+
+// ns per output sample of one node rendering full blocks.
+void benchNode(const std::string &name, Node &node, const Block &block,
+               long size = 0, double perSampleDivisor = 1.0) {
+  if (!selected("nodes", name))
+    return;
+  const long iterations = options.quick ? 2000 : 20000;
+  for (int i = 0; i < 100; i++)
+    node.process(block);
+  double ns = medianNs(5, iterations, [&] { node.process(block); });
+  report("nodes", name, size, ns / block.frames / perSampleDivisor,
+         perSampleDivisor == 1.0 ? "ns/sample" : "ns/partial-sample");
+}
+
+void benchNodes() {
+  Block block;
+  block.frames = BLOCK_SIZE;
+
+  // a driver for modulated variants: audio-rate sweep over a control block
+  auto sweep = makeLFO(880.0f, 440.0f, 3.0f, Waveform::Sine);
+  sweep->process(block);
+
+  for (Waveform type : WAVEFORMS) {
+    std::string wf = waveformName(type);
+
+    auto osc = makeOscillator(440.0f, type);
+    benchNode("osc_" + wf + "_linear", *osc, block);
+    osc->interp = Interpolation::Cubic;
+    benchNode("osc_" + wf + "_cubic", *osc, block);
+    osc->interp = Interpolation::Linear;
+    osc->freq.source.store(sweep->out);
+    benchNode("osc_" + wf + "_freqmod", *osc, block);
+
+    auto lfo = makeLFO(0.0f, 1.0f, 2.0f, type);
+    benchNode("lfo_" + wf, *lfo, block);
+    lfo->decimation = 32;
+    benchNode("lfo_" + wf + "_decim32", *lfo, block);
+
+    for (int count : {16, 128}) {
+      auto bank = makeBank(count, type);
+      benchNode("bank_" + wf, *bank, block, count);
+      benchNode("bank_" + wf, *bank, block, count, count);
+    }
+  }
+
+  auto source = makeOscillator(220.0f, Waveform::Saw);
+  source->process(block);
+  const float *inputs[] = {source->out};
+  Block filtered = block;
+  filtered.inputs = inputs;
+  filtered.numInputs = 1;
+
+  auto filter = makeFilter(1200.0f, 2.0f);
+  benchNode("filter_static", *filter, filtered);
+
+  // includes the LFO driving the cutoff, since the pair is what a voice pays
+  auto cutoffLfo = makeLFO(1500.0f, 1000.0f, 4.0f, Waveform::Sine);
+  filter->cutoff.source.store(cutoffLfo->out);
+  if (selected("nodes", "filter_modulated")) {
+    const long iterations = options.quick ? 2000 : 20000;
+    double ns = medianNs(5, iterations, [&] {
+      cutoffLfo->process(block);
+      filter->process(filtered);
+    });
+    report("nodes", "filter_modulated", 0, ns / block.frames, "ns/sample");
+  }
+
+  // a voice's osc -> filter as two plan steps, then fused into one
+  filter->cutoff.set(1200.0f);
+  for (bool fused : {false, true}) {
+    std::string name = fused ? "osc_filter_fused" : "osc_filter";
+    if (!selected("nodes", name))
+      continue;
+    const long iterations = options.quick ? 2000 : 20000;
+    double ns = medianNs(5, iterations, [&] {
+      if (fused) {
+        source->processFused(block, *filter);
+      } else {
+        source->process(block);
+        filter->process(filtered);
+      }
+    });
+    report("nodes", name, 0, ns / block.frames, "ns/sample");
+  }
+}
+
+// --- callback ---------------------------------------------------------------
+
+// Typical voice shape: osc -> filter -> sink, with one LFO shared per eight
+// voices driving the cutoffs. Builds approximately `size` nodes.
+void buildPatch(Graph &graph, int size) {
+  int lfoId = -1;
+  int voice = 0;
+  while (static_cast<int>(graph.getNodes().size()) + 2 <= size) {
+    if (voice % 8 == 0 &&
+        static_cast<int>(graph.getNodes().size()) + 3 <= size) {
+      lfoId = graph.addNode(
+          makeLFO(1500.0f, 800.0f, 0.25f + 0.01f * voice, Waveform::Sine));
+    }
+    int osc = graph.addNode(
+        makeOscillator(110.0f + voice % 48 * 7.0f, WAVEFORMS[voice % 5]));
+    auto filter = makeFilter(1200.0f, 1.5f);
+    filter->addInput(graph.getNodes()[osc].get());
+    Filter *f = filter.get();
+    int filt = graph.addNode(std::move(filter));
+    graph.addEdge(osc, filt);
+    if (lfoId >= 0) {
+      auto *lfo = static_cast<LFO *>(graph.getNodes()[lfoId].get());
+      lfo->addTarget(&f->cutoff, f);
+      graph.setSource(f, &f->cutoff, lfo->out);
+      graph.addEdge(lfoId, filt);
+    }
+    graph.addSink(filt);
+    voice++;
+  }
+  while (static_cast<int>(graph.getNodes().size()) < size)
+    graph.addNode(makeOscillator(55.0f, Waveform::Sine));
+  graph.commit();
+}
+
+const int GRAPH_SIZES[] = {10, 100, 1000, 10000};
+
+// Leaves the heap the way a long session of reloads does: holes of mixed
+// sizes scattered between live blocks, which a patch built afterwards
+// gets spread across.
+struct ScatteredHeap {
+  std::vector<std::unique_ptr<char[]>> blocks;
+
+  explicit ScatteredHeap(int count) {
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> bytes(64, 8192);
+    for (int i = 0; i < count; i++)
+      blocks.emplace_back(new char[bytes(rng)]);
+    std::shuffle(blocks.begin(), blocks.end(), rng);
+    blocks.resize(blocks.size() / 2);
+  }
+};
+
+// 512 frames at the device rate, a common period size
+const ma_uint32 CALLBACK_FRAMES = 512;
+
+// Median time of one callback rendering `graph`, in ns.
+double timeCallback(Graph &graph, int size) {
+  const ma_uint32 frames = CALLBACK_FRAMES;
+  std::vector<float> out(frames * DEVICE_CHANNELS);
+  AudioEngine engine(graph, false);
+  engine.setThreads(options.threads);
+
+  long iterations = std::max(4L, (options.quick ? 200000L : 2000000L) / size);
+  for (int i = 0; i < 10; i++)
+    engine.render(out.data(), frames);
+  return medianNs(5, iterations, [&] { engine.render(out.data(), frames); });
+}
+
+void benchCallback() {
+  for (int size : GRAPH_SIZES) {
+    if (!selected("callback", "render_512"))
+      continue;
+    Graph graph;
+    buildPatch(graph, size);
+    double ns = timeCallback(graph, size);
+
+    double budgetNs = 1e9 * CALLBACK_FRAMES / SampleRate::get().hz;
+    report("callback", "render_512", size, ns / 1000.0, "us/callback");
+    report("callback", "render_512_load", size, 100.0 * ns / budgetNs,
+           "%budget");
+    report("callback", "render_per_node", size, ns / size / CALLBACK_FRAMES,
+           "ns/node-sample");
+  }
+
+  // the same patch built into a fragmented heap
+  for (int size : GRAPH_SIZES) {
+    if (!selected("callback", "render_scattered"))
+      continue;
+    ScatteredHeap heap(4 * size);
+    Graph graph;
+    buildPatch(graph, size);
+    double ns = timeCallback(graph, size);
+    report("callback", "render_scattered", size, ns / size / CALLBACK_FRAMES,
+           "ns/node-sample");
+  }
+
+  // the same patch with every osc -> filter pair rendered as two steps,
+  // against render_per_node above
+  for (int size : GRAPH_SIZES) {
+    if (!selected("callback", "render_unfused"))
+      continue;
+    Graph graph;
+    buildPatch(graph, size);
+    RenderPlan::fusion.store(false);
+    double ns = timeCallback(graph, size);
+    RenderPlan::fusion.store(true);
+    report("callback", "render_unfused", size, ns / size / CALLBACK_FRAMES,
+           "ns/node-sample");
+  }
+
+  // every oscillator at amp 0, the filters rung out: muted layers
+  for (int size : GRAPH_SIZES) {
+    if (!selected("callback", "render_muted"))
+      continue;
+    Graph graph;
+    buildPatch(graph, size);
+    for (std::unique_ptr<Node> &node : graph.getNodes())
+      if (auto *osc = dynamic_cast<Oscillator *>(node.get()))
+        osc->amp.set(0.0f);
+    double ns = timeCallback(graph, size);
+    report("callback", "render_muted", size, ns / size / CALLBACK_FRAMES,
+           "ns/node-sample");
+  }
+}
+
+// Master bus alone: summing `count` panned sinks and interleaving the
+// result, per sink and frame.
+void benchMix() {
+  for (int count : {16, 128}) {
+    if (!selected("callback", "mix"))
+      continue;
+    std::vector<std::unique_ptr<Oscillator>> sources;
+    std::vector<Node *> sinks;
+    Block block;
+    block.frames = BLOCK_SIZE;
+    for (int k = 0; k < count; k++) {
+      sources.push_back(makeOscillator(110.0f + 7.0f * k, Waveform::Saw));
+      sources.back()->process(block);
+      sources.back()->strip.set(0.5f, -1.0f + 2.0f * k / count);
+      sinks.push_back(sources.back().get());
+    }
+
+    MixBus bus;
+    float out[BLOCK_SIZE * DEVICE_CHANNELS];
+    const long iterations = options.quick ? 20000 : 200000;
+    double ns = medianNs(5, iterations, [&] {
+      bus.mix(sinks, BLOCK_SIZE);
+      bus.interleave(out, BLOCK_SIZE);
+    });
+    report("callback", "mix", count, ns / count / BLOCK_SIZE,
+           "ns/sink-sample");
+  }
+}
+
+// --- graph ------------------------------------------------------------------
+
+void benchGraph() {
+  for (int size : GRAPH_SIZES) {
+    if (selected("graph", "commit")) {
+      Graph graph;
+      buildPatch(graph, size);
+      long iterations = std::max(4L, (options.quick ? 20000L : 200000L) / size);
+      double ns = medianNs(5, iterations, [&] { graph.commit(); });
+      report("graph", "commit", size, ns / 1000.0, "us/call");
+    }
+
+    if (selected("graph", "add_edge")) {
+      // a late controller modulating an early node forces a reorder of
+      // everything positioned between them
+      Graph graph;
+      buildPatch(graph, size);
+      const int rounds = options.quick ? 50 : 500;
+      std::vector<double> samples;
+      for (int r = 0; r < rounds; r++) {
+        int lfo = graph.addNode(makeLFO(0.0f, 1.0f, 1.0f, Waveform::Sine));
+        int target = graph.getTopoOrder()[r % size];
+        auto start = Clock::now();
+        graph.addEdge(lfo, target);
+        samples.push_back(elapsedNs(start));
+      }
+      Percentiles p = percentiles(samples);
+      report("graph", "add_edge_p50", size, p.p50 / 1000.0, "us/call");
+      report("graph", "add_edge_p99", size, p.p99 / 1000.0, "us/call");
+    }
+
+    if (selected("graph", "remove_node")) {
+      // remove the filter of a voice and put it back, so the graph keeps
+      // its size; only the removal is timed
+      Graph graph;
+      buildPatch(graph, size);
+      const int rounds = std::min(options.quick ? 50 : 500, size);
+      std::vector<double> samples;
+      for (int r = 0; r < rounds; r++) {
+        const auto &sinks = graph.getSinkedNodes();
+        if (sinks.empty())
+          break;
+        int id = sinks[r % sinks.size()];
+        auto start = Clock::now();
+        graph.removeNode(id);
+        samples.push_back(elapsedNs(start));
+
+        int osc = graph.addNode(makeOscillator(110.0f, Waveform::Saw));
+        auto filter = makeFilter(1200.0f, 1.5f);
+        filter->addInput(graph.getNodes()[osc].get());
+        int filt = graph.addNode(std::move(filter));
+        graph.addEdge(osc, filt);
+        graph.addSink(filt);
+      }
+      if (!samples.empty()) {
+        Percentiles p = percentiles(samples);
+        report("graph", "remove_node_p50", size, p.p50 / 1000.0, "us/call");
+        report("graph", "remove_node_p99", size, p.p99 / 1000.0, "us/call");
+      }
+    }
+  }
+}
+
+// --- voice ------------------------------------------------------------------
+
+void benchVoices() {
+  for (int background : {0, 1000}) {
+    if (!selected("voice", "allocate") && !selected("voice", "free"))
+      continue;
+
+    Graph graph;
+    if (background)
+      buildPatch(graph, background);
+
+    const int maxVoices = 64;
+    VoiceManager voices(graph, maxVoices);
+    std::vector<NodeSpec> nodes = {
+        {SyncMode::PerVoice,
+         [] { return makeOscillator(220.0f, Waveform::Saw); }},
+        {SyncMode::PerVoice, [] { return makeFilter(1200.0f, 1.5f); }}};
+    std::vector<EdgeSpec> edges = {{0, 1}};
+    int tpl = voices.registerTemplate(
+        std::make_unique<VoiceTemplate>(nodes, edges, std::vector<ParamSpec>{}));
+
+    const int rounds = options.quick ? 20 : 200;
+    std::vector<double> allocNs, freeNs;
+    std::vector<int> held;
+    for (int r = 0; r < rounds; r++) {
+      for (int v = 0; v < maxVoices / 2; v++) {
+        auto start = Clock::now();
+        int id = voices.allocateVoice(tpl);
+        allocNs.push_back(elapsedNs(start));
+        held.push_back(id);
+      }
+      for (int id : held) {
+        auto start = Clock::now();
+        voices.freeVoice(id);
+        freeNs.push_back(elapsedNs(start));
+      }
+      held.clear();
+    }
+
+    Percentiles a = percentiles(allocNs);
+    Percentiles f = percentiles(freeNs);
+    report("voice", "allocate_p50", background, a.p50 / 1000.0, "us/call");
+    report("voice", "allocate_p99", background, a.p99 / 1000.0, "us/call");
+    report("voice", "free_p50", background, f.p50 / 1000.0, "us/call");
+    report("voice", "free_p99", background, f.p99 / 1000.0, "us/call");
+  }
+
+  // Note on with the pool full, so every note steals. Pitches never repeat:
+  // same_pitch scans everything and falls back to the oldest voice.
+  const std::pair<StealPolicy, const char *> policies[] = {
+      {StealPolicy::Oldest, "oldest"},
+      {StealPolicy::Quietest, "quietest"},
+      {StealPolicy::SamePitch, "same_pitch"}};
+  for (const auto &[policy, policyName] : policies) {
+    std::string name = std::string("steal_") + policyName;
+    if (!selected("voice", name))
+      continue;
+
+    Graph graph;
+    const int maxVoices = 64;
+    VoiceManager voices(graph, maxVoices);
+    std::vector<NodeSpec> nodes = {
+        {SyncMode::PerVoice,
+         [] { return makeOscillator(220.0f, Waveform::Saw); }},
+        {SyncMode::PerVoice, [] { return makeFilter(1200.0f, 1.5f); }}};
+    int tpl = voices.registerTemplate(std::make_unique<VoiceTemplate>(
+        nodes, std::vector<EdgeSpec>{{0, 1}}, std::vector<ParamSpec>{}));
+    voices.setStealPolicy(policy);
+
+    const int notes = options.quick ? 2000 : 20000;
+    std::vector<double> stealNs;
+    for (int n = 0; n < notes; n++) {
+      auto start = Clock::now();
+      voices.allocateVoice(tpl, 100.0f + n);
+      if (n >= maxVoices)
+        stealNs.push_back(elapsedNs(start));
+    }
+    Percentiles p = percentiles(stealNs);
+    report("voice", name + "_p50", 0, p.p50 / 1000.0, "us/call");
+    report("voice", name + "_p99", 0, p.p99 / 1000.0, "us/call");
+  }
+}
+
+// --- lua --------------------------------------------------------------------
+
+// Throughput of parameter changes from Lua, the path a live-coded patch
+// takes on every edit: ns and bytes of Lua heap per call, each measured
+// over a loop run inside Lua so the loop itself is part of the cost.
+void benchLua() {
+  struct Case {
+    const char *name;
+    const char *body; // runs with `o` an oscillator and `i` the counter
+  };
+  const Case cases[] = {
+      {"method_call", "o.freq(100 + i % 1000)"},
+      {"field_set", "o.amp = (i % 100) / 1000"},
+      {"method_lookup", "local f = o.freq"},
+  };
+
+  Graph graph;
+  AudioEngine engine(graph, false);
+  LuaContext ctx{&graph, &engine, {}};
+  lua_State *L = luaL_newstate();
+  luaL_openlibs(L);
+  registerLuaBindings(L, &ctx);
+
+  // node constructors announce themselves on stdout, which carries results
+  std::ostringstream quiet;
+  auto *out = std::cout.rdbuf(quiet.rdbuf());
+  bool ready = luaL_dostring(L, "o = osc(0.1, 440, Sine)") == LUA_OK;
+  std::cout.rdbuf(out);
+  if (!ready) {
+    std::cerr << "lua: " << lua_tostring(L, -1) << std::endl;
+    lua_close(L);
+    return;
+  }
+
+  const long calls = options.quick ? 100000 : 1000000;
+  for (const Case &c : cases) {
+    if (!selected("lua", c.name))
+      continue;
+    std::string chunk = "local o = o\nfor i = 1, " + std::to_string(calls) +
+                        " do " + c.body + " end";
+    if (luaL_loadstring(L, chunk.c_str()) != LUA_OK) {
+      std::cerr << "lua: " << lua_tostring(L, -1) << std::endl;
+      lua_pop(L, 1);
+      continue;
+    }
+    int loop = luaL_ref(L, LUA_REGISTRYINDEX);
+
+    std::vector<double> runs;
+    double bytes = 0.0;
+    for (int r = 0; r < 5; r++) {
+      lua_gc(L, LUA_GCCOLLECT, 0);
+      lua_gc(L, LUA_GCSTOP, 0); // count allocations, not what survives
+      long before = lua_gc(L, LUA_GCCOUNT, 0) * 1024L +
+                    lua_gc(L, LUA_GCCOUNTB, 0);
+      lua_rawgeti(L, LUA_REGISTRYINDEX, loop);
+      auto start = Clock::now();
+      lua_call(L, 0, 0);
+      runs.push_back(elapsedNs(start) / calls);
+      long after = lua_gc(L, LUA_GCCOUNT, 0) * 1024L +
+                   lua_gc(L, LUA_GCCOUNTB, 0);
+      lua_gc(L, LUA_GCRESTART, 0);
+      bytes = static_cast<double>(after - before) / calls;
+    }
+    luaL_unref(L, LUA_REGISTRYINDEX, loop);
+    std::sort(runs.begin(), runs.end());
+    report("lua", c.name, 0, runs[runs.size() / 2], "ns/call");
+    report("lua", std::string(c.name) + "_alloc", 0, bytes, "bytes/call");
+  }
+  lua_close(L);
+}
+
+// --- output -----------------------------------------------------------------
+
+void printCsv() {
+  std::printf("suite,name,size,value,unit\n");
+  for (const Result &r : results)
+    std::printf("%s,%s,%ld,%.4f,%s\n", r.suite.c_str(), r.name.c_str(), r.size,
+                r.value, r.unit.c_str());
+}
+
+void printJson() {
+  std::printf("{\n  \"block_size\": %d,\n  \"sample_rate\": %.1f,\n"
+              "  \"threads\": %d,\n",
+              BLOCK_SIZE, static_cast<double>(SampleRate::get().hz),
+              options.threads);
+  std::printf("  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    std::printf("    {\"suite\": \"%s\", \"name\": \"%s\", \"size\": %ld, "
+                "\"value\": %.4f, \"unit\": \"%s\"}%s\n",
+                r.suite.c_str(), r.name.c_str(), r.size, r.value,
+                r.unit.c_str(), i + 1 < results.size() ? "," : "");
+  }
+  std::printf("  ]\n}\n");
+}
+
+void usage(const char *argv0) {
+  std::cerr << "usage: " << argv0
+            << " [--format csv|json] [--quick] [--filter <substring>]"
+            << " [--threads N]"
+            << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      std::string format = argv[++i];
+      if (format != "csv" && format != "json") {
+        usage(argv[0]);
+        return 1;
+      }
+      options.json = format == "json";
+    } else if (std::strcmp(argv[i], "--quick") == 0) {
+      options.quick = true;
+    } else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      options.filter = argv[++i];
+    } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      options.threads = std::atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  Wavetable::init();
+
+  benchNodes();
+  benchCallback();
+  benchMix();
+  benchGraph();
+  benchVoices();
+  benchLua();
+
+  if (options.json)
+    printJson();
+  else
+    printCsv();
+  return 0;
+}
@@ -1,4 +1,4 @@
-BPM = 120
+BPM = tempo(120)
 BPS = BPM / 60
 
 -- Note = lfo(45, 5, BPS / 4, 0, Square)
@@ -12,12 +12,15 @@ BPS = BPM / 60
 -- SAME AS BELOW:
 
 Base = osc(0.1, 0, Saw)
+Note = lfo(45, 5, BPS / 4, 0, Square)
 sound(Base)
 	.amp(lfo(0.05, 0.05, BPS, 0, InvSaw))
-	.freq(lfo(45, 5, BPS / 4, 0, Square))
+	.freq(Note)
 	.effect(filter(0, 10))
 	.cutoff(lfo(1000, 1000, BPS, 0, InvSaw))
 	.play()
+-- two half-bar notes, on the beat grid, around which Note still trills
+seq(Note, "base", { 50, 40 }, 2)
 
 Main = osc(0.1, 200, Sine)
 sound(Main).amp(lfo(0.05, 0.05, BPS * 2, 0, Square)).play()
@@ -2,24 +2,82 @@
 
 #include "graph.h"
 #include "miniaudio.h"
+#include "mix.h"
+#include "stats.h"
+#include "workers.h"
 
 #include <atomic>
+#include <cstdint>
 #include <vector>
 
+class PatternEngine;
+class VoiceManager;
+
+// Device setup; zero leaves the choice to the device or backend.
+struct AudioConfig {
+  uint32_t sampleRate = 0;   // 0: the device's native rate, no resampling
+  uint32_t periodFrames = 0; // frames per callback
+  uint32_t periods = 0;      // periods in the device buffer
+};
+
 class AudioEngine {
   ma_device_config deviceConfig{};
   ma_device device{};
   std::atomic<bool> running{false};
   bool audioInitialized;
+  bool useDevice;
+  AudioConfig config; // as granted by the device
 
-  std::vector<unique_ptr<Node>> &nodes;
-  std::vector<int> &topoOrder;
-  std::vector<int> &sinkedNodes;
+  Graph &graph;
+  std::atomic<PatternEngine *> events{nullptr};
+  std::atomic<VoiceManager *> voices{nullptr};
+  std::atomic<uint64_t> clock{0}; // frames rendered since start
+  std::atomic<float> rate{DEFAULT_SAMPLE_RATE}; // SampleRate, for other threads
+  WorkerPool workers;
+  MixBus bus;
+  CallbackStats stats; // device callbacks only, not offline renders
 
+  void closeDevice();
   static void dataCallback(ma_device *pDevice, void *pOutput,
                            const void * /*pInput*/, ma_uint32 frameCount);
 
 public:
-  AudioEngine(Graph &graph);
+  // With `openDevice` false the engine never touches a playback device and
+  // is driven through render() instead (offline bounce, benchmarks).
+  AudioEngine(Graph &graph, bool openDevice = true,
+              const AudioConfig &config = {});
   ~AudioEngine();
+
+  // Control thread. (Re)open the device with `request`; all nodes are reset
+  // as the sample rate may change. Without a device only the rate is taken
+  // (DEFAULT_SAMPLE_RATE for 0). Returns false if the device failed to open.
+  bool configure(const AudioConfig &request);
+  const AudioConfig &getConfig() const { return config; }
+
+  // Evaluate the graph for `frameCount` frames into interleaved `out`.
+  // Blocks are split at event timestamps so each event is applied before
+  // the exact frame it is stamped with.
+  void render(float *out, ma_uint32 frameCount);
+
+  // Source of timed events; must outlive rendering.
+  void setPatternEngine(PatternEngine *pe);
+
+  // Voices whose limit follows the device callback load (see
+  // VoiceManager::governLoad); must outlive rendering. Offline renders
+  // have no deadline and leave the limit alone.
+  void setVoiceManager(VoiceManager *vm);
+
+  // Helper threads rendering independent parts of the graph next to the
+  // callback thread; 0 renders on the callback thread alone.
+  void setThreads(int count) { workers.setWorkers(count); }
+  int getThreads() const { return workers.getWorkers(); }
+
+  // Load, timing histogram and overruns of the device callback.
+  CallbackStats &callbackStats() { return stats; }
+
+  // Audio clock in frames: the timestamp of the next frame to be rendered.
+  uint64_t now() const { return clock.load(std::memory_order_acquire); }
+  // The rate the audio clock runs at. Unlike SampleRate::get(), safe to
+  // read from any thread while configure() runs.
+  float sampleRate() const { return rate.load(std::memory_order_acquire); }
 };
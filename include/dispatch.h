@@ -0,0 +1,61 @@
+#pragma once
+
+#include "globals.h"
+#include "graph.h"
+
+#include <type_traits>
+
+// Per-block dispatch from runtime settings to specialized kernels. A node
+// reads its settings once per block and passes a generic lambda to one of
+// these; the lambda receives each setting as a compile-time constant, so
+// the loops it instantiates carry no branches on it:
+//
+//   withWaveform(wf, [&](auto w) { render<decltype(w)::value>(...); });
+//   withFlag(amp.source != nullptr, [&](auto modulated) { ... });
+
+template <Waveform W> using WaveformTag = std::integral_constant<Waveform, W>;
+
+template <typename F> decltype(auto) withWaveform(Waveform type, F &&f) {
+  switch (type) {
+  case Waveform::Saw:
+    return f(WaveformTag<Waveform::Saw>{});
+  case Waveform::InvSaw:
+    return f(WaveformTag<Waveform::InvSaw>{});
+  case Waveform::Square:
+    return f(WaveformTag<Waveform::Square>{});
+  case Waveform::Triangle:
+    return f(WaveformTag<Waveform::Triangle>{});
+  case Waveform::Sine:
+    break;
+  }
+  return f(WaveformTag<Waveform::Sine>{});
+}
+
+// `flag` as std::true_type or std::false_type.
+template <typename F> decltype(auto) withFlag(bool flag, F &&f) {
+  if (flag)
+    return f(std::true_type{});
+  return f(std::false_type{});
+}
+
+// Frame i of a parameter whose modulation is known at compile time: the
+// source block if Modulated, else the block's constant value.
+template <bool Modulated>
+inline float paramAt(const ModParam::Snapshot &p, int i) {
+  if constexpr (Modulated)
+    return p.source[i];
+  else
+    return p.value;
+}
+
+// The parameter as a block of `frames` values: the source itself when
+// modulated, else `scratch` filled with the value. For kernels reading
+// several parameters where any mix of them may be modulated.
+inline const float *paramBlock(const ModParam::Snapshot &p, float *scratch,
+                               int frames) {
+  if (p.source)
+    return p.source;
+  for (int i = 0; i < frames; i++)
+    scratch[i] = p.value;
+  return scratch;
+}
@@ -2,11 +2,14 @@
 
 #include <cstdint>
 
+struct ModParam;
+
 enum EventType {
   NoteOn,   // spawn voice or sync reset
   NoteOff,  // release temp voice
   SetParam, // set node parameter
-  KillAll
+  KillAll,
+  SetValue  // set a ModParam directly (sequencer steps)
 };
 
 struct NoteOnPayload {
@@ -17,6 +20,7 @@ struct NoteOnPayload {
 
 struct NoteOffPayload {
   uint16_t voiceId;
+  uint64_t note; // the voice's note count at NoteOn (VoiceInstance::startedAt)
 };
 
 struct SetParamPayload {
@@ -25,12 +29,27 @@ struct SetParamPayload {
   float value;
 };
 
+struct SetValuePayload {
+  ModParam *param;
+  float value;
+};
+
 struct Event {
   EventType type;
+  uint32_t epoch; // PatternEngine::flush() count at scheduling
   uint64_t tsSamples;
   union {
     NoteOnPayload spawn;
     NoteOffPayload release;
     SetParamPayload setParam;
+    SetValuePayload setValue;
   };
 };
+
+// Applies events on the audio thread at their timestamp, between blocks.
+// Implementations must not block or allocate.
+class EventHandler {
+public:
+  virtual ~EventHandler() = default;
+  virtual void handleEvent(const Event &event) = 0;
+};
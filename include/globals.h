@@ -1,9 +1,15 @@
 #pragma once
 
-#define DEVICE_SAMPLE_RATE 44800.0f
+// Render rate when neither the command line nor the device picks one; the
+// rate in use is SampleRate::get().
+#define DEFAULT_SAMPLE_RATE 48000.0f
 #define DEVICE_FORMAT ma_format_f32
 #define DEVICE_CHANNELS 2
 
+// Maximum number of frames a node renders per process() call. The audio
+// callback splits device buffers into blocks of at most this size.
+#define BLOCK_SIZE 64
+
 enum class Waveform : int {
   Sine = 0,
   Saw = 1,
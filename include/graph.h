@@ -1,47 +1,292 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <queue>
+#include <utility>
 #include <vector>
 
+#include "globals.h"
+
 enum class SyncMode { PerVoice, Shared };
 
+// Per-call view handed to Node::process by the render plan.
+struct Block {
+  int frames = 0;                       // <= BLOCK_SIZE
+  const float *const *inputs = nullptr; // upstream audio blocks
+  int numInputs = 0;
+};
+
+// Level and placement of a sink on the master bus. The channel gains are
+// worked out here, on the control thread, so the callback only loads them.
+struct SinkStrip {
+  std::atomic<float> gain{1.0f};
+  std::atomic<float> pan{0.0f}; // -1 hard left .. 1 hard right
+  std::atomic<float> left{1.0f};
+  std::atomic<float> right{1.0f};
+  std::atomic<bool> mute{false};
+  std::atomic<bool> solo{false};
+
+  // Equal-power pan scaled so that centre is unity on both channels, the
+  // level every sink had before the bus was stereo.
+  void set(float gain, float pan);
+};
+
+// Fields written by the control thread come first; audio-owned state starts
+// on its own cache line so control writes never invalidate it.
 struct Node {
   std::atomic<bool> sinked = false; // audioOut
-  std::atomic<float> out{0.0f};
+  SinkStrip strip;                  // used while sinked
   std::atomic<SyncMode> syncMode{SyncMode::PerVoice};
 
+  // Inactive nodes stay in the plan but are skipped, their `out` held at
+  // silence; pooled voices toggle this instead of editing the graph.
+  std::atomic<bool> active{true};
+
+  alignas(64) float out[BLOCK_SIZE] = {}; // last rendered block
+  bool silent = false; // audio thread: `out` zeroed, parked or asleep
+  float busGain[2] = {}; // audio thread: channel gains of the last mix
+
+  // Smoothed render cost in ns per frame, kept while RenderPlan::timing is
+  // on. Written by whichever thread renders the node.
+  std::atomic<float> cost{0.0f};
+
   virtual ~Node() = default;
-  virtual void update() = 0;
+
+  // Render `block.frames` samples into `out`.
+  virtual void process(const Block &block) = 0;
+
+  // Upstream nodes feeding process() as audio inputs. Control-side wiring;
+  // the audio thread only sees the copy resolved into the render plan.
+  virtual const std::vector<const Node *> &audioInputs() const;
+
+  // Return to the freshly created state (phase, filter memory) before a
+  // pooled voice is reused. Audio thread.
+  virtual void reset() {}
+
+  // Carry on from `previous`, the node this one replaces on reload: copy
+  // its phase, filter memory and the like. Audio thread, before the first
+  // block; a node of another type is ignored.
+  virtual void adopt(const Node & /*previous*/) {}
+
+  // Drop every connection between this node and `other` (about to be
+  // removed from the graph).
+  virtual void detach(Node * /*other*/) {}
+
+  // Whether this block can be skipped with `out` left silent, because the
+  // node would render silence from its parameters and, if
+  // `inputsSilent`, silent audio inputs. A node saying yes catches up on
+  // whatever it must (phase) itself; it is asked again every block, so
+  // any parameter or input change wakes it. Audio thread.
+  virtual bool sleeps(const Block & /*block*/, bool /*inputsSilent*/) {
+    return false;
+  }
+
+  // Controllers drive other nodes' ModParams instead of feeding audio
+  // inputs. The plan renders them in a phase of their own, before the
+  // nodes reading them, so they do not tie those nodes into one task.
+  virtual bool isControl() const { return false; }
+
+  // Whether this node can render together with `next`, its only consumer
+  // and `next`'s only audio input, in one processFused() pass.
+  virtual bool fusesWith(const Node & /*next*/) const { return false; }
+
+  // Render this node and then `next` fed by it, leaving both `out` blocks
+  // as two process() calls would. Only called for pairs fusesWith()
+  // accepted.
+  virtual void processFused(const Block & /*block*/, Node & /*next*/) {}
+};
+
+// Node parameter holding a scalar set from Lua or, when driven by a
+// ControlNode, a pointer to that controller's output block.
+struct ModParam {
+  std::atomic<float> value{0.0f};
+  std::atomic<const float *> source{nullptr};
+
+  // Plain copy taken once per block; inner loops only ever see this.
+  struct Snapshot {
+    float value;
+    const float *source;
+
+    float at(int i) const { return source ? source[i] : value; }
+  };
+
+  void set(float v) {
+    value.store(v, std::memory_order_relaxed);
+    // a reader that sees the cleared source also sees `v`
+    source.store(nullptr, std::memory_order_release);
+  }
+
+  Snapshot read() const {
+    const float *s = source.load(std::memory_order_acquire);
+    return {value.load(std::memory_order_relaxed), s};
+  }
 };
 
 struct Param {
-  std::atomic<float> *ptr;
+  ModParam *ptr;
   Node *owner;
 };
 
+// Immutable snapshot of everything the audio thread walks: node order with
+// resolved pointers grouped into independent tasks, audio inputs in CSR
+// form, and the sink list.
+struct RenderPlan {
+  struct Step {
+    Node *node;
+    int firstInput; // offset into inputs
+    int numInputs;
+    bool fuseNext = false; // render with the next step via processFused
+  };
+
+  // Connected component of the graph, edges from controllers left out: a
+  // run of steps sharing no data with any other task of its phase, so
+  // those tasks may render concurrently.
+  struct Task {
+    int firstStep;
+    int numSteps;
+  };
+
+  std::vector<Step> steps; // topological within each task
+  std::vector<const float *> inputs;
+  std::vector<const Node *> inputNodes; // owners of `inputs`, same order
+  // Two phases, each largest first: the first `controlTasks` hold the
+  // controllers, and all of them finish before any of the rest start.
+  std::vector<Task> tasks;
+  int controlTasks = 0;
+  std::vector<Node *> sinks;
+
+  // Render every step of `task` for `frames` frames.
+  void runTask(const Task &task, int frames) const;
+
+  // Nodes replaced in the edit that produced this plan: each successor
+  // adopts its predecessor's state the first time the plan is acquired.
+  // The plan owns the replaced nodes, so they outlive that moment.
+  struct Handoff {
+    Node *next;
+    const Node *previous;
+  };
+  std::vector<Handoff> handoffs;
+  std::vector<std::unique_ptr<Node>> replaced;
+  // Params whose controller changed in the edit, switched in order at
+  // the same moment: a node the previous plan rendered never reads a
+  // controller that plan did not render, nor loses one early.
+  struct Rewire {
+    const Node *owner;
+    ModParam *param;
+    const float *source;
+  };
+  std::vector<Rewire> rewires;
+  std::atomic<bool> handedOff{false}; // set by the audio thread
+
+  // Time every node as it renders (Node::cost); costs two clock reads per
+  // node and block, so it is off unless asked for.
+  static std::atomic<bool> timing;
+  // Render fuseNext pairs in one processFused call. On unless switched off
+  // to compare against rendering every step apart.
+  static std::atomic<bool> fusion;
+
+  // Flush denormals to zero on the calling thread (FTZ/DAZ), as every
+  // thread running tasks does: a decaying tail that reaches the denormal
+  // range makes x86 float arithmetic many times slower.
+  static void flushDenormals();
+};
+
 class Graph {
+  // Plan or node unlinked from the audio thread, freed once the callback
+  // that might still be using it has finished.
+  struct Retired {
+    uint64_t epoch;
+    std::unique_ptr<RenderPlan> plan;
+    std::unique_ptr<Node> node;
+  };
+
   std::vector<std::unique_ptr<Node>> nodes;
+  std::vector<uint32_t> generations; // bumped each time a slot is freed
   std::queue<int> freeIDs;
-  std::vector<std::vector<int>> parents;
+  std::vector<std::vector<int>> parents; // unordered, swap-pop removal
   std::vector<std::vector<int>> children;
-  std::vector<int> topoOrder; // cached
   std::vector<int> sinkedNodes;
 
+  // Topological order kept valid across every edit (Pearce-Kelly). Free
+  // slots keep their position, so a reused id needs no reordering.
+  std::vector<int> topoOrder; // position -> node id
+  std::vector<int> position;  // node id -> position
+
+  // addEdge scratch, kept to avoid allocating per edit
+  std::vector<char> visited;
+  std::vector<int> forward, backward, stack, slots;
+
+  bool discoverForward(int from, int upper, int target);
+  void discoverBackward(int from, int lower);
+  void reorder();
+
+  std::atomic<RenderPlan *> livePlan{nullptr};
+  std::atomic<uint64_t> renderEpoch{0}; // odd while the audio thread renders
+  std::vector<Retired> retired;
+
+  // beginEdit/endEdit nesting; commits and node frees wait for the end
+  int editDepth = 0;
+  bool editDirty = false;
+  std::vector<std::unique_ptr<Node>> editRemoved;
+  std::vector<std::pair<Node *, Node *>> editDetached; // links to unhook
+  std::vector<RenderPlan::Handoff> editHandoffs;
+  std::vector<RenderPlan::Rewire> editRewires;
+
+  void retire(std::unique_ptr<RenderPlan> plan, std::unique_ptr<Node> node);
+  void collectGarbage();
+
 public:
   Graph() = default;
-  ~Graph() = default;
+  ~Graph();
 
   int addNode(std::unique_ptr<Node> node);
   void removeNode(int id);
 
-  void addEdge(int parent, int child);
+  // Returns false, leaving the graph unchanged, if the edge would close a
+  // cycle. Cost is proportional to the region of the order it disturbs.
+  bool addEdge(int parent, int child);
+  void removeEdge(int parent, int child);
+  bool hasEdge(int parent, int child) const;
+  void addSink(int id);
+  void removeSink(int id);
+
+  // Drop the links Node::detach keeps between two nodes no longer joined
+  // by an edge. Inside an edit this waits for the commit, like the links
+  // of a removed node.
+  void unlink(int a, int b);
 
-  void sort(); // pass to topoOrder
+  // Drive `owner`'s `param` from a controller's `source` block, or from
+  // its own value with nullptr. Inside an edit, or while the last edit's
+  // plan waits for the audio thread, the switch happens as the plan is
+  // first acquired; source() tells what the param will read by then.
+  void setSource(const Node *owner, ModParam *param, const float *source);
+  const float *source(const ModParam &param) const;
+
+  void commit(); // publish the current order as a new render plan
+
+  // Group edits into one published plan: commit() inside the bracket only
+  // marks the plan stale, and the outermost endEdit() publishes it.
+  void beginEdit();
+  void endEdit();
+
+  // Inside an edit: `next` takes over the state of `previous` (Node::adopt)
+  // when the plan is published; `previous` is expected to be removed.
+  void handOff(int previous, int next);
   void traverse(const std::function<void(Node *)> &func);
 
+  // Audio thread: bracket every use of the plan. Wait-free.
+  const RenderPlan *acquirePlan();
+  void releasePlan();
+
+  // Changes whenever slot `id` is freed, so an (id, generation) pair kept
+  // by a handle detects a removed node even once the slot is reused.
+  uint32_t generation(int id) const { return generations[id]; }
+
   std::vector<std::unique_ptr<Node>> &getNodes();
-  std::vector<int> &getTopoOrder();
-  std::vector<int> &getSinkedNodes();
+  const std::vector<int> &getChildren(int id) const;
+  const std::vector<int> &getTopoOrder() const; // may hold free slots
+  const std::vector<int> &getSinkedNodes() const;
 };
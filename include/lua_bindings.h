@@ -3,13 +3,30 @@
 #include "audio.h"
 #include "graph.h"
 
+#include <deque>
+#include <string>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
 extern "C" {
 #include <lua.h>
 }
 
+class Sequencer;
+
 struct LuaContext {
   Graph *graph;
   AudioEngine *audio;
+  std::vector<int> created; // node ids made from Lua, in creation order
+  Sequencer *sequencer = nullptr;
+  // While a reload runs: the previous run's nodes by type, in creation
+  // order. A constructor takes the first of its type and sets it up in
+  // place instead of adding a node.
+  std::unordered_map<std::type_index, std::deque<int>> reusable;
 };
 
 void registerLuaBindings(lua_State *L, LuaContext *ctx);
+
+// Global name -> node id for every node handle bound to a global in `L`.
+std::unordered_map<std::string, int> namedNodes(lua_State *L);
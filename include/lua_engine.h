@@ -4,10 +4,14 @@
 #include "graph.h"
 #include "lua_bindings.h"
 #include "pattern.h"
+#include "sequencer.h"
+#include "watcher.h"
 
 #include <filesystem>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <thread>
+#include <vector>
 
 extern "C" {
 #include <lauxlib.h>
@@ -19,23 +23,31 @@ class LuaEngine {
   Graph &graph;
   AudioEngine &ae;
   PatternEngine &pe;
+  Sequencer &sequencer;
   lua_State *L;
   LuaContext ctx{};
 
-  std::thread watchThread;
-  std::atomic<bool> watchingFile{false};
+  // Patches re-run on reload, in order; the watcher also follows
+  // runtime.lua and every module they require. The lock serializes use of
+  // `L` between the REPL and reloads on the watcher thread.
+  std::vector<std::filesystem::path> patches;
+  std::unique_ptr<FileWatcher> watcher;
+  std::mutex luaMutex;
+
+  void openState(); // fresh lua_State with bindings and runtime.lua
+  void updateWatcher();
 
 public:
-  LuaEngine(Graph &graph, AudioEngine &ae, PatternEngine &pe);
+  LuaEngine(Graph &graph, AudioEngine &ae, PatternEngine &pe,
+            Sequencer &sequencer);
   ~LuaEngine();
 
   void bindFunction(const std::string &name, lua_CFunction fn);
 
   void runString(const std::string &code);
-  void runFile(const std::filesystem::path &path);
-  void reloadFile(const std::filesystem::path &path);
-
-  void startWatcher(const std::filesystem::path &path);
+  void runFile(const std::filesystem::path &path, bool watch = true);
+  // Re-run every watched patch, keeping the state of matching nodes.
+  void reload();
   void stopWatcher();
 
   void loop(); // use readString
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "graph.h"
+
+#include <vector>
+
+// Master bus: every sink is summed into planar left/right blocks with its
+// strip's gain, pan, mute and solo, then the pair is interleaved into the
+// device buffer in one pass. Audio thread only.
+class MixBus {
+public:
+  // Sum `frames` frames of `sinks` into the bus, replacing what it held.
+  // Gain changes ramp across the block instead of stepping.
+  void mix(const std::vector<Node *> &sinks, int frames);
+
+  // Write the bus to `out` as DEVICE_CHANNELS interleaved channels.
+  void interleave(float *out, int frames) const;
+
+private:
+  alignas(64) float left[BLOCK_SIZE] = {};
+  alignas(64) float right[BLOCK_SIZE] = {};
+};
@@ -2,55 +2,174 @@
 
 #include "graph.h"
 
+#include <cstdint>
+
 #include "globals.h"
+#include "pool.h"
+#include "wavetable.h"
+
+// Concrete node types take their storage from per-type slabs (Pooled), so
+// the render plan walks a few dense arrays rather than scattered heap
+// blocks.
 
 struct ControlNode : Node {
-  std::vector<std::atomic<float> *> targets;
-  void addTarget(std::atomic<float> *target);
+  static constexpr int MAX_DECIMATION = 4096;
+
+  std::vector<Param> targets;
+
+  // Samples per control tick. The value is computed once per tick and `out`
+  // ramps linearly between ticks; 1 is audio rate, 0 follows the global
+  // default.
+  std::atomic<int> decimation{0};
+  static std::atomic<int> defaultDecimation; // 1 unless changed
+
+  int controlInterval() const;
+
+  // Record `target` as driven by this node, so detach() can release it;
+  // pointing it at `out` is Graph::setSource's job. Once per target.
+  void addTarget(ModParam *target, Node *owner);
+  void detach(Node *other) override;
+  bool isControl() const override { return true; }
 };
 
 struct EffectNode : Node {
-  std::vector<std::atomic<float> *> inputs;
-  void addInput(std::atomic<float> *input);
+  std::vector<const Node *> inputs;
+  void addInput(const Node *input); // once per input
+  const std::vector<const Node *> &audioInputs() const override;
+  void detach(Node *other) override;
+};
+
+// Audio source with amp/freq, the head of a sound() chain.
+struct SourceNode : Node {
+  ModParam amp;
+  ModParam freq;
 };
 
-struct Oscillator : Node {
-  std::atomic<float> amp{1.0f};
-  std::atomic<float> freq{440.0f};
-  std::atomic<float> phase{0.0f};
+struct Oscillator : SourceNode, Pooled<Oscillator> {
   std::atomic<Waveform> type{Waveform::Sine};
+  std::atomic<const Wavetable *> table{nullptr}; // user table, overrides type
+  std::atomic<Interpolation> interp{Interpolation::Linear};
 
-  void update() override;
+  alignas(64) float phase = 0.0f; // audio-owned, cycles, 0..1
+
+  void process(const Block &block) override;
+  void reset() override;
+  void adopt(const Node &previous) override;
+  bool sleeps(const Block &block, bool inputsSilent) override; // amp 0
+
+  // Osc -> filter: each sample goes into the biquad as it is looked up.
+  bool fusesWith(const Node &next) const override;
+  void processFused(const Block &block, Node &next) override;
 
   static std::unique_ptr<Oscillator> init(float amp_ = 1.0f,
                                           float freq_ = 440.0f,
                                           Waveform type_ = Waveform::Sine);
+
+private:
+  // Set up the block (phases, mip level) and call `kernel` with the
+  // interpolation and amp modulation as compile-time flags.
+  template <typename Kernel> void render(int frames, Kernel &&kernel);
 };
 
-struct LFO : ControlNode {
-  std::atomic<float> base{0.0f};
-  std::atomic<float> amp{1.0f};
-  std::atomic<float> freq{5.0f};
-  std::atomic<float> shift{0.0f};
-  std::atomic<float> phase{0.0f};
+enum class BankMode : int {
+  Unison = 0,  // every partial near freq, detuned across `spread` cents
+  Harmonic = 1 // partial k at k * freq with 1/k amplitude
+};
+
+// Many oscillators rendered as one node from structure-of-arrays state,
+// vectorized across partials (AVX2/SSE2, scalar fallback at runtime).
+struct OscillatorBank : SourceNode, Pooled<OscillatorBank> {
+  static constexpr int MAX_PARTIALS = 512;
+
+  std::atomic<int> count{16};
+  std::atomic<float> spread{0.0f}; // cents
+  std::atomic<Waveform> type{Waveform::Saw};
+  std::atomic<BankMode> mode{BankMode::Unison};
+  std::atomic<uint32_t> version{0}; // bumped by configure()
+
+  // audio-owned
+  alignas(64) float phases[MAX_PARTIALS] = {};
+  alignas(32) float ratios[MAX_PARTIALS] = {};
+  alignas(32) float gains[MAX_PARTIALS] = {};
+  int activeCount = 0;
+  uint32_t seenVersion = ~0u;
+
+  void process(const Block &block) override;
+  void reset() override;
+  void adopt(const Node &previous) override;
+
+  // Control thread: publish count/spread/mode changes to the audio thread.
+  void configure() { version.fetch_add(1, std::memory_order_release); }
+
+  static std::unique_ptr<OscillatorBank>
+  init(float amp_ = 1.0f, float freq_ = 110.0f, int count_ = 16,
+       float spread_ = 0.0f, Waveform type_ = Waveform::Saw,
+       BankMode mode_ = BankMode::Unison);
+
+private:
+  void rebuild();
+};
+
+struct LFO : ControlNode, Pooled<LFO> {
+  ModParam base;
+  ModParam amp;
+  ModParam freq;
+  ModParam shift; // radians
   std::atomic<Waveform> type{Waveform::Sine};
 
-  void update() override;
+  alignas(64) float phase = 0.0f; // audio-owned, cycles, 0..1
+
+  // audio-owned control-rate ramp: `current` moves by `slope` per sample
+  // for `countdown` more samples, reaching the next tick's value
+  float current = 0.0f;
+  float slope = 0.0f;
+  int countdown = 0;
+  bool primed = false;
+
+  void process(const Block &block) override;
+  void reset() override;
+  void adopt(const Node &previous) override;
 
   static std::unique_ptr<LFO> init(float base_ = 0.0f, float amp_ = 1.0f,
                                    float freq_ = 5.0f, float shift_ = 0.0f,
                                    Waveform type_ = Waveform::Sine);
+
+private:
+  template <Waveform W> void render(int frames); // process() for one shape
 };
 
-struct Filter : EffectNode {
-  std::atomic<float> cutoff{500.0f};
-  std::atomic<float> q{1.0f};
-  float x1 = 0.0f;
+struct Filter : EffectNode, Pooled<Filter> {
+  ModParam cutoff;
+  ModParam q;
+
+  // audio-owned biquad history
+  alignas(64) float x1 = 0.0f;
   float x2 = 0.0f;
   float y1 = 0.0f;
   float y2 = 0.0f;
 
-  void update() override;
+  // Biquad coefficients normalized by a0, as reached at the end of the last
+  // block, and the cutoff/q they were designed for (negative = not yet).
+  float b0 = 0.0f, b1 = 0.0f, b2 = 0.0f, a1 = 0.0f, a2 = 0.0f;
+  float designedCutoff = -1.0f;
+  float designedQ = -1.0f;
+
+  void process(const Block &block) override;
+  void reset() override;
+  void adopt(const Node &previous) override;
+  // silent inputs and a tail rung out below TAIL, which is then flushed
+  bool sleeps(const Block &block, bool inputsSilent) override;
+
+  // State magnitude counted as silence, about -200 dB: far below hearing
+  // and far above the denormal range.
+  static constexpr float TAIL = 1e-10f;
 
   static std::unique_ptr<Filter> init(float cutoff_ = 500.0f, float q_ = 1.0f);
+
+private:
+  friend struct Oscillator; // fused osc -> filter
+
+  // The biquad over input(i) for i in [0, frames), coefficients designed
+  // for this block's cutoff and q.
+  template <typename Input> void render(int frames, Input &&input);
 };
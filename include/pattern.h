@@ -23,17 +23,68 @@ Need to implement:
 
 #pragma once
 
-#include <queue>
+#include <atomic>
+#include <cstdint>
 #include <string>
+#include <unordered_map>
 
 #include "event.h"
+#include "ring.h"
 #include "voice.h"
 
 class PatternEngine {
-  std::queue<Event> eventQueue;
+  static constexpr size_t QUEUE_CAPACITY = 4096;
+
+  // Event plus arrival order, so equal timestamps keep their push order.
+  struct Pending {
+    Event event;
+    uint64_t seq;
+  };
+
+  SpscRing<Event, QUEUE_CAPACITY> eventQueue; // control -> audio thread
   std::unordered_map<std::string, int> cueMap;
+  std::atomic<EventHandler *> handler{nullptr};
+  std::atomic<uint32_t> epoch{0}; // bumped by flush()
+
+  // Audio thread: events taken off the ring, min-heap on (tsSamples, seq).
+  Pending pending[QUEUE_CAPACITY];
+  size_t pendingCount = 0;
+  uint64_t nextSeq = 0;
+  uint32_t seenEpoch = 0;
+
+  void drain();
+  static bool later(const Pending &a, const Pending &b);
 
 public:
   PatternEngine() = default;
   ~PatternEngine() = default;
+
+  // Control thread, one at a time. Queue `event` for sample `tsSamples` of
+  // the audio clock (AudioEngine::now()); past timestamps fire at the next
+  // block. Returns false if the queue is full.
+  bool schedule(const Event &event);
+
+  // Queue a batch the same way, published at once. Events must carry
+  // currentEpoch(). Returns how many were taken; the rest did not fit.
+  size_t schedule(const Event *events, size_t count);
+  size_t space() const { return eventQueue.space(); }
+
+  // Drop every event not yet dispatched, e.g. before the nodes they point
+  // at are removed. Events stamped before the flush never fire.
+  void flush() { epoch.fetch_add(1, std::memory_order_release); }
+  uint32_t currentEpoch() const {
+    return epoch.load(std::memory_order_acquire);
+  }
+
+  // Receiver of due events; nullptr drops them.
+  void setHandler(EventHandler *h);
+
+  // Audio thread. Frames from `now` until the next pending event, capped
+  // at `limit`; 0 if one is already due (pushed since dispatchDue), which
+  // the caller must dispatch before rendering.
+  uint32_t framesUntilNext(uint64_t now, uint32_t limit);
+
+  // Audio thread. Hand every event due at or before `now` to the handler,
+  // in timestamp order. Returns true if any were dispatched.
+  bool dispatchDue(uint64_t now);
 };
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+// Slab storage for one node type. Slots are carved from chunks of
+// SLAB_SLOTS, so nodes of a type created together sit next to each other
+// in memory, and a freed slot is handed out again before the pool grows.
+// Chunks are never returned. Allocation is control-thread work (node
+// creation and the deferred frees in Graph); the lock only guards
+// against two control threads.
+template <typename T> class NodePool {
+public:
+  static constexpr size_t SLAB_SLOTS = 64;
+
+  static void *allocate() {
+    NodePool &pool = instance();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (!pool.freeList)
+      pool.grow();
+    Slot *slot = pool.freeList;
+    pool.freeList = slot->next;
+    return slot;
+  }
+
+  static void release(void *p) {
+    NodePool &pool = instance();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    auto *slot = static_cast<Slot *>(p);
+    slot->next = pool.freeList;
+    pool.freeList = slot;
+  }
+
+private:
+  union Slot {
+    Slot *next;
+    alignas(T) unsigned char bytes[sizeof(T)];
+  };
+
+  std::mutex mutex;
+  Slot *freeList = nullptr;
+
+  // never destroyed: nodes owned by statics may be freed during exit,
+  // after a function-local pool would already be gone
+  static NodePool &instance() {
+    static NodePool *pool = new NodePool;
+    return *pool;
+  }
+
+  void grow() {
+    auto *chunk = static_cast<Slot *>(::operator new(
+        SLAB_SLOTS * sizeof(Slot), std::align_val_t(alignof(Slot))));
+    // thread in reverse so slots are handed out in address order
+    for (size_t i = SLAB_SLOTS; i-- > 0;) {
+      chunk[i].next = freeList;
+      freeList = &chunk[i];
+    }
+  }
+};
+
+// Base giving node type T pooled storage through class operator new and
+// delete. A type derived from T is larger than a slot and falls back to
+// the global heap; the sized delete tells the two apart.
+template <typename T> struct Pooled {
+  static void *operator new(std::size_t size) {
+    if (size == sizeof(T))
+      return NodePool<T>::allocate();
+    return ::operator new(size, std::align_val_t(alignof(T)));
+  }
+
+  static void operator delete(void *p, std::size_t size) {
+    if (size == sizeof(T))
+      NodePool<T>::release(p);
+    else
+      ::operator delete(p, std::align_val_t(alignof(T)));
+  }
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "globals.h"
+
+// Rate the graph renders at, with the reciprocals nodes need precomputed
+// so per-block code multiplies instead of divides. Only changed by the
+// AudioEngine while nothing renders (device closed, or before an offline
+// render); nodes read it once per block.
+class SampleRate {
+public:
+  float hz;
+  float inv;     // 1 / hz: seconds per frame, cycles per frame per Hz
+  float nyquist; // hz / 2
+
+  static const SampleRate &get() { return current; }
+
+  static void set(float hz) {
+    current.hz = hz;
+    current.inv = 1.0f / hz;
+    current.nyquist = 0.5f * hz;
+  }
+
+private:
+  static SampleRate current;
+};
+
+inline SampleRate SampleRate::current{DEFAULT_SAMPLE_RATE,
+                                      1.0f / DEFAULT_SAMPLE_RATE,
+                                      0.5f * DEFAULT_SAMPLE_RATE};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "audio.h"
+#include "sequencer.h"
+
+#include <filesystem>
+
+struct RenderStats {
+  double audioSeconds = 0.0;  // length of rendered material
+  double renderSeconds = 0.0; // wall-clock time spent evaluating the graph
+
+  double realtimeFactor() const {
+    return renderSeconds > 0.0 ? audioSeconds / renderSeconds : 0.0;
+  }
+};
+
+// Drive `engine` for `seconds` of audio without a playback device, as fast
+// as the CPU allows. Writes a 32-bit float WAV to `outPath` unless it is
+// empty. `sequencer`, if given, is pumped before every chunk since it has
+// no real time to follow. Returns false if the output file could not be
+// written.
+bool renderOffline(AudioEngine &engine, double seconds,
+                   const std::filesystem::path &outPath, RenderStats &stats,
+                   Sequencer *sequencer = nullptr);
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded lock-free single-producer/single-consumer queue. One thread may
+// push and one other thread may pop; neither ever blocks or allocates.
+template <typename T, size_t Capacity> class SpscRing {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "capacity must be a power of two");
+
+  static constexpr size_t MASK = Capacity - 1;
+
+  // indices only grow; slot = index & MASK
+  alignas(64) std::atomic<size_t> head{0}; // next pop, owned by the consumer
+  alignas(64) std::atomic<size_t> tail{0}; // next push, owned by the producer
+  alignas(64) T slots[Capacity];
+
+public:
+  // Producer. Returns false when the ring is full.
+  bool push(const T &item) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == Capacity)
+      return false;
+    slots[t & MASK] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Producer. Push up to `count` items with one publication; returns how
+  // many fit.
+  size_t push(const T *items, size_t count) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t free = Capacity - (t - head.load(std::memory_order_acquire));
+    if (count > free)
+      count = free;
+    for (size_t i = 0; i < count; i++)
+      slots[(t + i) & MASK] = items[i];
+    tail.store(t + count, std::memory_order_release);
+    return count;
+  }
+
+  // Producer. Items a push() can take now; only grows until the next push.
+  size_t space() const {
+    return Capacity - (tail.load(std::memory_order_relaxed) -
+                       head.load(std::memory_order_acquire));
+  }
+
+  // Consumer. Returns false when the ring is empty.
+  bool pop(T &item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+      return false;
+    item = slots[h & MASK];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  static constexpr size_t capacity() { return Capacity; }
+};
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "audio.h"
+#include "event.h"
+#include "pattern.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Beats to audio clock samples for a tempo that changes at given beats.
+// Segments hold their start sample, so a conversion is one multiply-add
+// once the segment is found; lookups mostly move forward and start from
+// the segment used last.
+class TempoMap {
+public:
+  // Beat `beat` falls on sample `sample`, at `bpm` from there on.
+  void reset(double beat, double sample, double bpm, float rate);
+  // Change to `bpm` from `beat`, dropping changes after it.
+  void setTempo(double beat, double bpm);
+
+  double sampleAt(double beat) const;
+  double beatAt(double sample) const;
+  double tempo() const; // bpm of the last segment
+  float rate() const { return sampleRate; }
+
+  // Drop segments wholly before `beat`; they can no longer be asked for.
+  void prune(double beat);
+
+private:
+  struct Segment {
+    double beat;
+    double sample;
+    double samplesPerBeat;
+  };
+  std::vector<Segment> segments; // by beat, never empty once reset
+  float sampleRate = 0.0f;
+  mutable size_t cached = 0;
+
+  const Segment &segmentFor(double beat) const;
+};
+
+// Step pattern compiled from Lua: values at beat offsets within one loop.
+struct Pattern {
+  struct Step {
+    double beat; // 0 <= beat < length
+    float value;
+  };
+  std::vector<Step> steps; // by beat
+  double length = 0.0;     // beats per loop
+};
+
+// Lookahead sequencer. Patterns loop on a shared beat grid whose beat 0 is
+// where the first one started. A background thread wakes a few times per
+// lookahead window and pushes every step up to `lookahead` beats ahead of
+// the audio clock to the PatternEngine in one batch, stamped to its exact
+// sample. It is the PatternEngine's only producer.
+class Sequencer {
+public:
+  static constexpr double DEFAULT_BPM = 120.0;
+  static constexpr double DEFAULT_LOOKAHEAD = 4.0; // beats: a 4/4 bar
+
+  Sequencer(AudioEngine &audio, PatternEngine &events);
+  ~Sequencer();
+
+  // Control thread. A new tempo applies from the first beat not already
+  // scheduled, so it is heard up to one lookahead window later.
+  void setTempo(double bpm);
+  double getTempo();
+  void setLookahead(double beats);
+  double getLookahead();
+
+  // Loop `pattern` into `param`, from the current beat on. `param` must
+  // stay alive until the track is dropped.
+  void addTrack(ModParam *param, Pattern pattern);
+  size_t trackCount();
+  // Drop the `count` oldest tracks and every queued event; the tracks
+  // left are scheduled again from the current beat.
+  void dropTracks(size_t count);
+
+  // Schedule up to the lookahead horizon. The thread calls this; an offline
+  // render, which runs ahead of real time, calls it before every chunk.
+  void pump();
+
+  void start(); // background thread
+  void stop();
+
+private:
+  struct Track {
+    ModParam *param;
+    Pattern pattern;
+    uint64_t loop = 0; // cursor: next step is steps[index] of loop `loop`
+    size_t index = 0;
+  };
+
+  AudioEngine &audio;
+  PatternEngine &events;
+
+  std::mutex mutex; // everything below
+  std::condition_variable wake;
+  std::thread thread;
+  bool quit = false;
+
+  TempoMap tempo;
+  bool running = false;     // transport started: beat 0 is placed
+  double bpm = DEFAULT_BPM;
+  double lookahead = DEFAULT_LOOKAHEAD;
+  double horizon = 0.0;     // beats scheduled so far, all tracks
+  std::vector<Track> tracks;
+  std::vector<Event> batch; // reused
+
+  void startTransport();
+  double currentBeat() const;
+  void seek(Track &track, double beat) const;
+  void pumpLocked();
+  void run();
+};
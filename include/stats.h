@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Timing of the device callback. The callback is the only writer of every
+// counter, so recording is a handful of plain atomic stores; the control
+// thread reads them relaxed and may see one callback half-counted.
+class CallbackStats {
+public:
+  // Callback time as a share of its deadline, 1/8 of the deadline per bin;
+  // the last bin also collects everything longer.
+  static constexpr int HISTOGRAM_BINS = 16;
+  static constexpr int BINS_PER_DEADLINE = 8;
+
+  struct Snapshot {
+    uint64_t callbacks = 0;
+    uint64_t xruns = 0;      // callbacks that overran their deadline
+    float lastLoad = 0.0f;   // 1.0 = the whole deadline
+    float peakLoad = 0.0f;
+    float meanLoad = 0.0f;   // busy time over deadline time since reset
+    uint64_t histogram[HISTOGRAM_BINS] = {};
+  };
+
+  // Audio thread, once per callback.
+  void record(uint64_t busyNanos, uint64_t deadlineNanos);
+
+  // Control thread.
+  Snapshot read() const;
+  void reset(); // applied by the next record()
+
+private:
+  std::atomic<uint64_t> callbacks{0};
+  std::atomic<uint64_t> xruns{0};
+  std::atomic<uint64_t> busyTotal{0};
+  std::atomic<uint64_t> deadlineTotal{0};
+  std::atomic<float> lastLoad{0.0f};
+  std::atomic<float> peakLoad{0.0f};
+  std::atomic<uint64_t> histogram[HISTOGRAM_BINS] = {};
+
+  std::atomic<uint32_t> resetRequests{0};
+  uint32_t resetsDone = 0; // audio-owned
+};
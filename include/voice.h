@@ -2,14 +2,19 @@
 
 #include <atomic>
 #include <memory>
-#include <queue>
 #include <vector>
 
+#include "event.h"
 #include "globals.h"
 #include "graph.h"
 
 enum class VoiceState { Active, Releasing, Inactive };
 
+// Which sounding voice a note takes over once its template's pool is empty
+// or the voice limit is reached. None drops the note instead; SamePitch
+// retriggers a voice already playing the pitch, else the oldest.
+enum class StealPolicy { None, Oldest, Quietest, SamePitch };
+
 enum class ParamKind {
   // Oscilator params
   OscFreq,
@@ -56,7 +61,7 @@ struct ParamSpec {
 struct ParamBinding {
   ParamKind kind{ParamKind::OscFreq};
   union {
-    std::atomic<float> *f;
+    ModParam *f;
     std::atomic<bool> *b;
     std::atomic<Waveform> *w;
   } ptr;
@@ -78,13 +83,17 @@ public:
   const std::vector<ParamSpec> &params() const { return params_; }
 };
 
-// voice object with stored node ids and retrigger logic
+// Pooled voice: nodes are built once when the template is registered and
+// parked inactive; activate()/deactivate() only flip flags and reset state.
 class VoiceInstance {
   int voiceId{-1};
   int templateId{-1};
-  std::vector<int> nodeIds; // graph node IDs owned by this voice
-  std::vector<ParamBinding> paramBindings;
+  std::vector<int> nodeIds;        // graph node IDs, template order
+  std::vector<Node *> voiceNodes;  // the per-voice subset of nodeIds
+  std::vector<ParamBinding> paramBindings; // indexed by ParamSpec::paramId
   VoiceState state{VoiceState::Inactive};
+  uint64_t startedAt{0}; // note count at activation, for oldest-first
+  float pitch{0.0f};
 
 public:
   VoiceInstance() = default;
@@ -100,32 +109,104 @@ public:
   }
 
   void setNodeIds(std::vector<int> ids) { nodeIds = std::move(ids); }
+  void setVoiceNodes(std::vector<Node *> nodes) {
+    voiceNodes = std::move(nodes);
+  }
 
   void setState(VoiceState s) { state = s; }
 
+  // Reset and un-park the per-voice nodes, or park them again.
+  void activate(uint64_t note, float pitch);
+  void deactivate();
+
+  // Energy of the voice's output over its last block: of its loudest
+  // sinked node, or of its loudest node when none of those sound.
+  float level() const;
+
   std::vector<int> &getNodeIds() { return nodeIds; }
+  const std::vector<ParamBinding> &getBindings() const { return paramBindings; }
 
+  int getTemplateId() const { return templateId; }
   VoiceState getState() const { return state; }
+  uint64_t getStartedAt() const { return startedAt; }
+  float getPitch() const { return pitch; }
 };
 
-// Stores and manages slots and active voices
-class VoiceManager {
-  int maxVoices;
-  std::queue<int> freeVoiceIds;
+// Stores and manages slots and active voices. Every registered template
+// gets a pool of `maxVoices` prebuilt voices, so allocateVoice/freeVoice
+// never allocate or touch the graph and are safe on the audio thread. As an
+// EventHandler it applies PatternEngine events there.
+//
+// Voices sounding at once, over all templates, are held to a limit that
+// governLoad() moves with the callback load: cut in proportion when a
+// callback nears its deadline, shedding the excess voices right away, and
+// raised one voice at a time while there is headroom.
+class VoiceManager : public EventHandler {
+public:
+  static constexpr float LOAD_HIGH = 0.85f;  // share of deadline: cut
+  static constexpr float LOAD_TARGET = 0.7f; // aimed for by a cut
+  static constexpr float LOAD_LOW = 0.6f;    // below: raise
+  static constexpr int RAISE_INTERVAL = 16;  // callbacks per voice raised
+
+private:
+  int maxVoices; // pool size per template
   std::vector<std::unique_ptr<VoiceTemplate>> voiceTemplates;
-  std::vector<std::unique_ptr<VoiceInstance>> voiceInstances;
+  std::vector<std::unique_ptr<VoiceInstance>> voiceInstances; // all pools
+  std::vector<std::vector<int>> freeVoiceIds; // per template, used as stack
   std::vector<std::vector<int>> sharedNodeIds;
 
   Graph &graph;
 
+  // set by the control thread
+  std::atomic<StealPolicy> stealPolicy{StealPolicy::None};
+  std::atomic<int> voiceCap{0}; // 0: no cap beyond the pools
+
+  // audio thread
+  std::atomic<int> voiceLimit{0}; // 0: not governed yet; read by control
+  int activeVoices = 0;
+  uint64_t notes = 0;
+  float load = 0.0f; // callback load, peaks held, decays slowly
+  float loadAtCut = 0.0f; // load that made the last cut; 0 once it eased
+  int cutHold = 0;        // callbacks before another cut
+  int raiseCountdown = RAISE_INTERVAL;
+
+  std::vector<int> instantiateNodes(int templateId);
+  std::vector<ParamBinding> instantiateParams(int templateId,
+                                              const std::vector<int> &nodeIds);
+
+  int limit() const; // voices allowed to sound now
+  // Voice `policy` would take for a note at `pitch`, among the voices of
+  // `templateId` (-1: every template). -1 if none sound.
+  int pickVictim(StealPolicy policy, int templateId, float pitch) const;
+
 public:
   VoiceManager(Graph &graph, int maxVoices);
-  ~VoiceManager();
+  ~VoiceManager() override;
 
+  // Control thread. Builds the template's voice pool into the graph.
   int registerTemplate(std::unique_ptr<VoiceTemplate> voiceTemplate);
-  std::vector<int> instantiateNodes(int templateId);
-  std::vector<ParamBinding> instantiateParams(int templateId);
-  int allocateVoice(int templateId);
+
+  // Control thread; take effect from the next note or callback.
+  void setStealPolicy(StealPolicy policy);
+  StealPolicy getStealPolicy() const;
+  void setVoiceCap(int voices); // 0 removes the cap
+  int getVoiceCap() const;
+  int getVoiceLimit() const; // as last governed, 0 before any callback
+
+  // -1 when the pool is exhausted or the limit reached and the policy
+  // is None.
+  int allocateVoice(int templateId, float pitch = 0.0f);
   void freeVoice(int voiceId);
+  // Free `voiceId` only if it still plays note `note`; a release meant for
+  // a voice stolen since then leaves the new note alone.
+  void releaseVoice(int voiceId, uint64_t note);
   void freeAllVoices();
+
+  // Audio thread, once per device callback with its share of the deadline.
+  void governLoad(float callbackLoad);
+
+  // Write `value` through binding `paramId` of a live voice.
+  void setParam(int voiceId, int paramId, float value);
+
+  void handleEvent(const Event &event) override;
 };
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+// Calls `onChange` from its own thread once a watched file has changed and
+// writes have settled for DEBOUNCE. On Linux this is inotify on the parent
+// directories, so editors that save by writing a temporary file and
+// renaming it over the original are seen too; elsewhere modification times
+// are polled.
+class FileWatcher {
+public:
+  static constexpr std::chrono::milliseconds DEBOUNCE{5};
+
+  explicit FileWatcher(std::function<void()> onChange);
+  ~FileWatcher();
+
+  // Replace the set of watched files. Safe from any thread, including from
+  // inside `onChange`.
+  void setFiles(const std::vector<std::filesystem::path> &files);
+
+private:
+  std::function<void()> onChange;
+  std::mutex mutex;
+  std::set<std::filesystem::path> files; // normalized absolute paths
+  std::atomic<bool> quit{false};
+  std::thread thread;
+
+  // inotify; -1 where unavailable, which selects polling
+  int inotifyFd = -1;
+  int wakeFds[2] = {-1, -1}; // pipe: wakes the thread to quit
+  std::map<int, std::filesystem::path> directories; // watch -> directory
+
+  // polling fallback: last seen modification time per file
+  std::map<std::filesystem::path, std::filesystem::file_time_type> stamps;
+
+  void runNotify();
+  void runPolling();
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "globals.h"
+
+#include <vector>
+
+enum class Interpolation : int { Linear = 0, Cubic = 1 };
+
+// Band-limited single-cycle table, mip-mapped by octave so that the highest
+// harmonic of the selected level stays below Nyquist.
+class Wavetable {
+public:
+  static constexpr int SIZE = 2048; // samples per cycle
+  static constexpr int LEVELS = 11; // level k keeps harmonics <= 1024 >> k
+
+  // Level to play at `increment` cycles per sample.
+  static int levelFor(float increment);
+
+  // Table for level k, readable at indices -1 .. SIZE + 2.
+  const float *level(int k) const { return data.data() + k * STRIDE + 1; }
+
+  // `phase` is normalized to [0, 1).
+  static float lookup(const float *table, float phase) {
+    float x = phase * SIZE;
+    int i = static_cast<int>(x);
+    float frac = x - i;
+    return table[i] + frac * (table[i + 1] - table[i]);
+  }
+
+  static float lookupCubic(const float *table, float phase) {
+    float x = phase * SIZE;
+    int i = static_cast<int>(x);
+    float t = x - i;
+    float y0 = table[i - 1], y1 = table[i], y2 = table[i + 1],
+          y3 = table[i + 2];
+    // Catmull-Rom
+    float c1 = 0.5f * (y2 - y0);
+    float c2 = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+    float c3 = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+    return ((c3 * t + c2) * t + c1) * t + y1;
+  }
+
+  // Shared tables for the built-in waveforms. init() builds them all and
+  // must run before the audio thread starts; get() never builds.
+  static void init();
+  static const Wavetable &get(Waveform type);
+
+  // Band-limited mips of a user-supplied single cycle of any length.
+  // Interned: identical cycles share one table, which lives until exit.
+  static const Wavetable *fromCycle(const std::vector<float> &cycle);
+
+private:
+  static constexpr int STRIDE = SIZE + 4; // one guard before, three after
+
+  std::vector<float> data = std::vector<float>(LEVELS * STRIDE, 0.0f);
+
+  // Fill every level from harmonic amplitudes (cos, sin), index = harmonic.
+  void build(const std::vector<float> &cosAmp, const std::vector<float> &sinAmp,
+             bool normalize);
+};
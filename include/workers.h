@@ -0,0 +1,62 @@
+#pragma once
+
+#include "graph.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Helper threads that render a plan's independent tasks alongside the
+// audio callback. The callback thread always takes part, so zero workers
+// means plain single-threaded rendering.
+class WorkerPool {
+public:
+  static constexpr int MAX_WORKERS = 31;
+
+  WorkerPool() = default;
+  ~WorkerPool();
+
+  // Control thread. Capped at one less than the core count. Threads are
+  // started on demand and only parked, never joined, when the count goes
+  // down.
+  void setWorkers(int count);
+  int getWorkers() const { return active.load(std::memory_order_relaxed); }
+
+  // Audio thread. Render every task of `plan`, controllers first; returns
+  // once all are done.
+  void run(const RenderPlan &plan, int frames);
+
+private:
+  // Per-participant share of the tasks: indices offset, offset + stride,
+  // ... up to `count` of them. `next` packs the job generation in its high
+  // half so a worker waking late can never claim from a newer job.
+  struct alignas(64) Queue {
+    std::atomic<uint64_t> next{0};
+    std::atomic<int> count{0};
+    int offset = 0;
+    int stride = 1;
+  };
+
+  Queue queues[MAX_WORKERS + 1]; // [0] belongs to the callback thread
+  std::atomic<const RenderPlan *> plan{nullptr};
+  std::atomic<int> frames{0};
+  std::atomic<int> participants{1};
+  std::atomic<int> remaining{0};
+  std::atomic<uint32_t> generation{0};
+
+  std::atomic<int> active{0}; // workers asked for
+  std::vector<std::thread> threads;
+  std::atomic<bool> quit{false};
+
+  std::mutex parkMutex;
+  std::condition_variable parkSignal;
+  std::atomic<int> parked{0};
+
+  void runPhase(const RenderPlan &plan, int first, int numTasks, int frames);
+  void workerLoop(int self);
+  void work(int self, uint32_t gen);
+  int claim(Queue &queue, uint32_t gen);
+};
@@ -2,6 +2,7 @@ local raw = {
   osc = osc,
   lfo = lfo,
   filter = filter,
+  bank = bank,
   sound = sound,
 }
 
@@ -57,8 +58,15 @@ local oscSpec = {
 }
 
 local lfoSpec = {
-  defaults = { base = 0.0, amp = 1.0, freq = 5.0, shift = 0.0, type = Sine },
-  order = { "base", "amp", "freq", "shift", "type" },
+  defaults = { base = 0.0, amp = 1.0, freq = 5.0, shift = 0.0, type = Sine,
+               decimation = 0 },
+  order = { "base", "amp", "freq", "shift", "type", "decimation" },
+}
+
+local bankSpec = {
+  defaults = { amp = 1.0, freq = 110.0, count = 16, spread = 0.0, type = Saw,
+               mode = Unison },
+  order = { "amp", "freq", "count", "spread", "type", "mode" },
 }
 
 local filterSpec = {
@@ -73,7 +81,8 @@ end
 
 function lfo(...)
   local cfg = parse_params(lfoSpec, ...)
-  return raw.lfo(cfg.base, cfg.amp, cfg.freq, cfg.shift, cfg.type)
+  return raw.lfo(cfg.base, cfg.amp, cfg.freq, cfg.shift, cfg.type,
+                 cfg.decimation)
 end
 
 function filter(...)
@@ -81,6 +90,12 @@ function filter(...)
   return raw.filter(cfg.cutoff, cfg.q)
 end
 
+function bank(...)
+  local cfg = parse_params(bankSpec, ...)
+  return raw.bank(cfg.amp, cfg.freq, cfg.count, cfg.spread, cfg.type,
+                  cfg.mode)
+end
+
 local function apply_steps(builder, steps)
   if not steps then
     return builder
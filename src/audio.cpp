@@ -1,69 +1,148 @@
 #include "audio.h"
 
 #include "globals.h"
+#include "pattern.h"
+#include "rate.h"
+#include "voice.h"
+#include "wavetable.h"
+
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <iostream>
+
+AudioEngine::AudioEngine(Graph &graph, bool openDevice,
+                         const AudioConfig &config)
+    : audioInitialized(false), useDevice(openDevice), graph(graph) {
 
-AudioEngine::AudioEngine(Graph &graph)
-    : audioInitialized(false), nodes(graph.getNodes()),
-      topoOrder(graph.getTopoOrder()), sinkedNodes(graph.getSinkedNodes()) {
+  // build shared oscillator tables before any callback can run
+  Wavetable::init();
+  configure(config);
+}
 
-  if (audioInitialized)
-    return;
+AudioEngine::~AudioEngine() { closeDevice(); }
+
+void AudioEngine::closeDevice() {
+  if (audioInitialized) {
+    ma_device_uninit(&device);
+    audioInitialized = false;
+    running.store(false);
+  }
+}
+
+bool AudioEngine::configure(const AudioConfig &request) {
+  closeDevice();
+
+  // No callback runs now: node state and the rate can change freely.
+  for (std::unique_ptr<Node> &node : graph.getNodes())
+    if (node)
+      node->reset();
+
+  config = request;
+  if (!useDevice) {
+    if (config.sampleRate == 0)
+      config.sampleRate = static_cast<uint32_t>(DEFAULT_SAMPLE_RATE);
+    SampleRate::set(static_cast<float>(config.sampleRate));
+    rate.store(static_cast<float>(config.sampleRate));
+    return true;
+  }
 
   deviceConfig = ma_device_config_init(ma_device_type_playback);
   deviceConfig.playback.format = DEVICE_FORMAT;
   deviceConfig.playback.channels = DEVICE_CHANNELS;
-  deviceConfig.sampleRate = DEVICE_SAMPLE_RATE;
+  deviceConfig.sampleRate = request.sampleRate;
+  deviceConfig.periodSizeInFrames = request.periodFrames;
+  deviceConfig.periods = request.periods;
+  if (request.periodFrames > 0 && request.periodFrames <= 256)
+    deviceConfig.performanceProfile = ma_performance_profile_low_latency;
   deviceConfig.dataCallback = AudioEngine::dataCallback;
   deviceConfig.pUserData = this;
 
   if (ma_device_init(NULL, &deviceConfig, &device) != MA_SUCCESS) {
-    return;
+    std::cerr << "Could not open the audio device" << std::endl;
+    return false;
   }
 
+  // render at whatever rate the device settled on
+  config.sampleRate = device.sampleRate;
+  config.periodFrames = device.playback.internalPeriodSizeInFrames;
+  config.periods = device.playback.internalPeriods;
+  SampleRate::set(static_cast<float>(config.sampleRate));
+  rate.store(static_cast<float>(config.sampleRate));
+
   if (ma_device_start(&device) != MA_SUCCESS) {
+    std::cerr << "Could not start the audio device" << std::endl;
     ma_device_uninit(&device);
-    return;
+    return false;
   }
 
   audioInitialized = true;
   running.store(true);
-}
-
-AudioEngine::~AudioEngine() {
-  if (audioInitialized) {
-    ma_device_uninit(&device);
-    audioInitialized = false;
-    running.store(false);
-  }
+  return true;
 }
 
 void AudioEngine::dataCallback(ma_device *pDevice, void *pOutput,
                                const void * /*pInput*/, ma_uint32 frameCount) {
+  using clock = std::chrono::steady_clock;
+  auto start = clock::now();
+
   auto *manager = static_cast<AudioEngine *>(pDevice->pUserData);
-  float *out = static_cast<float *>(pOutput);
-
-  for (ma_uint32 frame = 0; frame < frameCount; frame++) {
-    for (int nodeId : manager->topoOrder) {
-      if (nodeId < 0 || nodeId >= static_cast<int>(manager->nodes.size()))
-        continue;
-      auto *node = manager->nodes[nodeId].get();
-      if (!node)
-        continue;
-      node->update();
-    }
+  manager->render(static_cast<float *>(pOutput), frameCount);
+
+  // the device wants the next period after frameCount frames of playback
+  auto busy = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      clock::now() - start);
+  uint64_t deadline = static_cast<uint64_t>(
+      1e9 * frameCount / SampleRate::get().hz);
+  manager->stats.record(static_cast<uint64_t>(busy.count()), deadline);
+  VoiceManager *vm = manager->voices.load(std::memory_order_acquire);
+  if (vm && deadline > 0) // an empty callback has no load to govern by
+    vm->governLoad(static_cast<float>(busy.count()) / deadline);
+}
 
-    float sample = 0.0f;
-    for (int nodeId : manager->sinkedNodes) {
-      if (nodeId < 0 || nodeId >= static_cast<int>(manager->nodes.size()))
-        continue;
-      auto *node = manager->nodes[nodeId].get();
-      if (!node)
-        continue;
-      sample += node->out.load(std::memory_order_relaxed);
+void AudioEngine::setPatternEngine(PatternEngine *pe) {
+  events.store(pe, std::memory_order_release);
+}
+
+void AudioEngine::setVoiceManager(VoiceManager *vm) {
+  voices.store(vm, std::memory_order_release);
+}
+
+void AudioEngine::render(float *out, ma_uint32 frameCount) {
+  // callers' threads are not ours to set up once: the device's, or the
+  // offline loop's
+  RenderPlan::flushDenormals();
+  PatternEngine *pe = events.load(std::memory_order_acquire);
+  uint64_t now = clock.load(std::memory_order_relaxed);
+  const RenderPlan *plan = graph.acquirePlan();
+
+  // Walk the plan once per block rather than once per frame; blocks end
+  // early at the next event so it lands on its exact frame.
+  for (ma_uint32 offset = 0; offset < frameCount;) {
+    if (pe)
+      pe->dispatchDue(now);
+
+    Block block;
+    ma_uint32 frames = std::min<ma_uint32>(BLOCK_SIZE, frameCount - offset);
+    if (pe)
+      frames = pe->framesUntilNext(now, frames);
+    if (frames == 0)
+      continue; // a due event arrived after dispatchDue: apply it first
+    block.frames = static_cast<int>(frames);
+
+    if (plan) {
+      workers.run(*plan, block.frames);
+      bus.mix(plan->sinks, block.frames);
+    } else {
+      bus.mix({}, block.frames);
     }
+    bus.interleave(out, block.frames);
 
-    *out++ = sample;
-    *out++ = sample;
+    out += frames * DEVICE_CHANNELS;
+    offset += frames;
+    now += frames;
   }
+
+  graph.releasePlan();
+  clock.store(now, std::memory_order_release);
 }
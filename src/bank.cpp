@@ -0,0 +1,443 @@
+#include "nodes.h"
+
+#include "rate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define TAKYON_X86 1
+#include <immintrin.h>
+#define TAKYON_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace {
+
+constexpr float PI_F = 3.14159265358979f;
+constexpr int WAVEFORM_COUNT = static_cast<int>(Waveform::Triangle) + 1;
+
+// Adds the gain-weighted sum of partials [0, count) into `out`. Partial k
+// advances by inc[i] * ratios[k] cycles per sample. Every ISA variant
+// shares this signature and the same math.
+using BankKernel = void (*)(const float *inc, int frames, float *phases,
+                            const float *ratios, const float *gains,
+                            int count, float *out);
+
+// --- Scalar -----------------------------------------------------------------
+
+// sin(2 pi t) for t in [0, 1): fold to a quarter wave, odd Taylor to x^9.
+inline float sineScalar(float t) {
+  float a = 2.0f * t - 1.0f; // sin(2 pi t) = -sin(pi a)
+  float b = a > 0.5f ? 1.0f - a : (a < -0.5f ? -1.0f - a : a);
+  float x = PI_F * b;
+  float x2 = x * x;
+  float p = 1.0f / 362880.0f;
+  p = p * x2 - 1.0f / 5040.0f;
+  p = p * x2 + 1.0f / 120.0f;
+  p = p * x2 - 1.0f / 6.0f;
+  p = p * x2 + 1.0f;
+  return -x * p;
+}
+
+// PolyBLEP residual for a unit-phase wrap at t = 0.
+inline float blepScalar(float t, float dt, float invDt) {
+  if (t < dt) {
+    float x = t * invDt - 1.0f;
+    return -x * x;
+  }
+  if (t > 1.0f - dt) {
+    float x = (t - 1.0f) * invDt + 1.0f;
+    return x * x;
+  }
+  return 0.0f;
+}
+
+template <Waveform W> inline float shapeScalar(float t, float dt) {
+  if constexpr (W == Waveform::Sine) {
+    return sineScalar(t);
+  } else if constexpr (W == Waveform::Triangle) {
+    return 4.0f * fabsf(t - 0.5f) - 1.0f;
+  } else {
+    float invDt = 1.0f / dt;
+    if constexpr (W == Waveform::Saw) {
+      return 2.0f * t - 1.0f - blepScalar(t, dt, invDt);
+    } else if constexpr (W == Waveform::InvSaw) {
+      return 1.0f - 2.0f * t + blepScalar(t, dt, invDt);
+    } else {
+      float t2 = t + 0.5f;
+      if (t2 >= 1.0f)
+        t2 -= 1.0f;
+      return (t < 0.5f ? 1.0f : -1.0f) + blepScalar(t, dt, invDt) -
+             blepScalar(t2, dt, invDt);
+    }
+  }
+}
+
+template <Waveform W>
+void bankScalar(const float *inc, int frames, float *phases,
+                const float *ratios, const float *gains, int count,
+                float *out) {
+  for (int k = 0; k < count; k++) {
+    float ph = phases[k];
+    for (int i = 0; i < frames; i++) {
+      float dt = inc[i] * ratios[k];
+      ph += dt;
+      if (ph >= 1.0f)
+        ph -= 1.0f;
+      if (ph < 0.0f)
+        ph += 1.0f;
+      out[i] += gains[k] * shapeScalar<W>(ph, fabsf(dt));
+    }
+    phases[k] = ph;
+  }
+}
+
+#ifdef TAKYON_X86
+
+// --- SSE2 (x86-64 baseline) -------------------------------------------------
+
+inline __m128 select4(__m128 mask, __m128 a, __m128 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+inline __m128 sine4(__m128 t) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  __m128 a = _mm_sub_ps(_mm_add_ps(t, t), one);
+  __m128 b = select4(_mm_cmpgt_ps(a, half), _mm_sub_ps(one, a), a);
+  b = select4(_mm_cmplt_ps(a, _mm_sub_ps(_mm_setzero_ps(), half)),
+              _mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), one), a), b);
+  __m128 x = _mm_mul_ps(_mm_set1_ps(PI_F), b);
+  __m128 x2 = _mm_mul_ps(x, x);
+  __m128 p = _mm_set1_ps(1.0f / 362880.0f);
+  p = _mm_sub_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.0f / 5040.0f));
+  p = _mm_add_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.0f / 120.0f));
+  p = _mm_sub_ps(_mm_mul_ps(p, x2), _mm_set1_ps(1.0f / 6.0f));
+  p = _mm_add_ps(_mm_mul_ps(p, x2), one);
+  return _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(x, p));
+}
+
+inline __m128 blep4(__m128 t, __m128 dt, __m128 invDt) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  __m128 x1 = _mm_sub_ps(_mm_mul_ps(t, invDt), one);
+  __m128 r1 = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(x1, x1));
+  __m128 x2 = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(t, one), invDt), one);
+  __m128 r2 = _mm_mul_ps(x2, x2);
+  __m128 lo = _mm_cmplt_ps(t, dt);
+  __m128 hi = _mm_cmpgt_ps(t, _mm_sub_ps(one, dt));
+  return select4(lo, r1, _mm_and_ps(hi, r2));
+}
+
+template <Waveform W> inline __m128 shape4(__m128 t, __m128 dt) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 two = _mm_set1_ps(2.0f);
+  if constexpr (W == Waveform::Sine) {
+    return sine4(t);
+  } else if constexpr (W == Waveform::Triangle) {
+    __m128 d = _mm_sub_ps(t, _mm_set1_ps(0.5f));
+    __m128 absd = _mm_andnot_ps(_mm_set1_ps(-0.0f), d);
+    return _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(4.0f), absd), one);
+  } else {
+    __m128 invDt = _mm_div_ps(one, dt);
+    if constexpr (W == Waveform::Saw) {
+      __m128 naive = _mm_sub_ps(_mm_mul_ps(two, t), one);
+      return _mm_sub_ps(naive, blep4(t, dt, invDt));
+    } else if constexpr (W == Waveform::InvSaw) {
+      __m128 naive = _mm_sub_ps(one, _mm_mul_ps(two, t));
+      return _mm_add_ps(naive, blep4(t, dt, invDt));
+    } else {
+      __m128 t2 = _mm_add_ps(t, _mm_set1_ps(0.5f));
+      t2 = _mm_sub_ps(t2, _mm_and_ps(_mm_cmpge_ps(t2, one), one));
+      __m128 naive = select4(_mm_cmplt_ps(t, _mm_set1_ps(0.5f)), one,
+                             _mm_sub_ps(_mm_setzero_ps(), one));
+      return _mm_sub_ps(_mm_add_ps(naive, blep4(t, dt, invDt)),
+                        blep4(t2, dt, invDt));
+    }
+  }
+}
+
+template <Waveform W>
+void bankSse2(const float *inc, int frames, float *phases, const float *ratios,
+              const float *gains, int count, float *out) {
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 signMask = _mm_set1_ps(-0.0f);
+  const __m128i laneIdx = _mm_setr_epi32(0, 1, 2, 3);
+  __m128 acc[BLOCK_SIZE];
+  for (int i = 0; i < frames; i++)
+    acc[i] = zero;
+
+  for (int k = 0; k < count; k += 4) {
+    // lanes past `count` contribute nothing
+    __m128 live = _mm_castsi128_ps(
+        _mm_cmpgt_epi32(_mm_set1_epi32(count - k), laneIdx));
+    __m128 gain = _mm_and_ps(_mm_load_ps(gains + k), live);
+    __m128 ratio = _mm_load_ps(ratios + k);
+    __m128 ph = _mm_load_ps(phases + k);
+
+    for (int i = 0; i < frames; i++) {
+      __m128 dt = _mm_mul_ps(_mm_set1_ps(inc[i]), ratio);
+      ph = _mm_add_ps(ph, dt);
+      ph = _mm_sub_ps(ph, _mm_and_ps(_mm_cmpge_ps(ph, one), one));
+      ph = _mm_add_ps(ph, _mm_and_ps(_mm_cmplt_ps(ph, zero), one));
+      __m128 v = shape4<W>(ph, _mm_andnot_ps(signMask, dt));
+      acc[i] = _mm_add_ps(acc[i], _mm_mul_ps(v, gain));
+    }
+    _mm_store_ps(phases + k, select4(live, ph, _mm_load_ps(phases + k)));
+  }
+
+  for (int i = 0; i < frames; i++) {
+    __m128 s = _mm_add_ps(acc[i], _mm_movehl_ps(acc[i], acc[i]));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    out[i] += _mm_cvtss_f32(s);
+  }
+}
+
+// --- AVX2 + FMA -------------------------------------------------------------
+
+TAKYON_AVX2 inline __m256 sine8(__m256 t) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 half = _mm256_set1_ps(0.5f);
+  __m256 a = _mm256_sub_ps(_mm256_add_ps(t, t), one);
+  __m256 b = _mm256_blendv_ps(a, _mm256_sub_ps(one, a),
+                              _mm256_cmp_ps(a, half, _CMP_GT_OQ));
+  b = _mm256_blendv_ps(
+      b, _mm256_sub_ps(_mm256_set1_ps(-1.0f), a),
+      _mm256_cmp_ps(a, _mm256_set1_ps(-0.5f), _CMP_LT_OQ));
+  __m256 x = _mm256_mul_ps(_mm256_set1_ps(PI_F), b);
+  __m256 x2 = _mm256_mul_ps(x, x);
+  __m256 p = _mm256_set1_ps(1.0f / 362880.0f);
+  p = _mm256_fmsub_ps(p, x2, _mm256_set1_ps(1.0f / 5040.0f));
+  p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(1.0f / 120.0f));
+  p = _mm256_fmsub_ps(p, x2, _mm256_set1_ps(1.0f / 6.0f));
+  p = _mm256_fmadd_ps(p, x2, one);
+  return _mm256_sub_ps(_mm256_setzero_ps(), _mm256_mul_ps(x, p));
+}
+
+TAKYON_AVX2 inline __m256 blep8(__m256 t, __m256 dt, __m256 invDt) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  __m256 x1 = _mm256_fmsub_ps(t, invDt, one);
+  __m256 r1 = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_mul_ps(x1, x1));
+  __m256 x2 = _mm256_fmadd_ps(_mm256_sub_ps(t, one), invDt, one);
+  __m256 r2 = _mm256_mul_ps(x2, x2);
+  __m256 lo = _mm256_cmp_ps(t, dt, _CMP_LT_OQ);
+  __m256 hi = _mm256_cmp_ps(t, _mm256_sub_ps(one, dt), _CMP_GT_OQ);
+  return _mm256_blendv_ps(_mm256_and_ps(hi, r2), r1, lo);
+}
+
+template <Waveform W> TAKYON_AVX2 inline __m256 shape8(__m256 t, __m256 dt) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+  if constexpr (W == Waveform::Sine) {
+    return sine8(t);
+  } else if constexpr (W == Waveform::Triangle) {
+    __m256 d = _mm256_sub_ps(t, _mm256_set1_ps(0.5f));
+    __m256 absd = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), d);
+    return _mm256_fmsub_ps(_mm256_set1_ps(4.0f), absd, one);
+  } else {
+    __m256 invDt = _mm256_div_ps(one, dt);
+    if constexpr (W == Waveform::Saw) {
+      __m256 naive = _mm256_fmsub_ps(two, t, one);
+      return _mm256_sub_ps(naive, blep8(t, dt, invDt));
+    } else if constexpr (W == Waveform::InvSaw) {
+      __m256 naive = _mm256_fnmadd_ps(two, t, one);
+      return _mm256_add_ps(naive, blep8(t, dt, invDt));
+    } else {
+      __m256 t2 = _mm256_add_ps(t, _mm256_set1_ps(0.5f));
+      t2 = _mm256_sub_ps(
+          t2, _mm256_and_ps(_mm256_cmp_ps(t2, one, _CMP_GE_OQ), one));
+      __m256 naive = _mm256_blendv_ps(
+          _mm256_set1_ps(-1.0f), one,
+          _mm256_cmp_ps(t, _mm256_set1_ps(0.5f), _CMP_LT_OQ));
+      return _mm256_sub_ps(_mm256_add_ps(naive, blep8(t, dt, invDt)),
+                           blep8(t2, dt, invDt));
+    }
+  }
+}
+
+template <Waveform W>
+TAKYON_AVX2 void bankAvx2(const float *inc, int frames, float *phases,
+                          const float *ratios, const float *gains, int count,
+                          float *out) {
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 signMask = _mm256_set1_ps(-0.0f);
+  const __m256i laneIdx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256 acc[BLOCK_SIZE];
+  for (int i = 0; i < frames; i++)
+    acc[i] = zero;
+
+  for (int k = 0; k < count; k += 8) {
+    // lanes past `count` contribute nothing
+    __m256 live = _mm256_castsi256_ps(
+        _mm256_cmpgt_epi32(_mm256_set1_epi32(count - k), laneIdx));
+    __m256 gain = _mm256_and_ps(_mm256_load_ps(gains + k), live);
+    __m256 ratio = _mm256_load_ps(ratios + k);
+    __m256 ph = _mm256_load_ps(phases + k);
+
+    for (int i = 0; i < frames; i++) {
+      __m256 dt = _mm256_mul_ps(_mm256_set1_ps(inc[i]), ratio);
+      ph = _mm256_add_ps(ph, dt);
+      ph = _mm256_sub_ps(
+          ph, _mm256_and_ps(_mm256_cmp_ps(ph, one, _CMP_GE_OQ), one));
+      ph = _mm256_add_ps(
+          ph, _mm256_and_ps(_mm256_cmp_ps(ph, zero, _CMP_LT_OQ), one));
+      __m256 v = shape8<W>(ph, _mm256_andnot_ps(signMask, dt));
+      acc[i] = _mm256_fmadd_ps(v, gain, acc[i]);
+    }
+    _mm256_store_ps(phases + k,
+                    _mm256_blendv_ps(_mm256_load_ps(phases + k), ph, live));
+  }
+
+  for (int i = 0; i < frames; i++) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(acc[i]),
+                          _mm256_extractf128_ps(acc[i], 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    out[i] += _mm_cvtss_f32(s);
+  }
+}
+
+#endif // TAKYON_X86
+
+#define TAKYON_BANK_KERNELS(fn)                                                \
+  {fn<Waveform::Sine>, fn<Waveform::Saw>, fn<Waveform::InvSaw>,                \
+   fn<Waveform::Square>, fn<Waveform::Triangle>}
+
+struct KernelSet {
+  const char *name;
+  BankKernel fn[WAVEFORM_COUNT];
+};
+
+const KernelSet SCALAR_KERNELS{"scalar", TAKYON_BANK_KERNELS(bankScalar)};
+#ifdef TAKYON_X86
+const KernelSet SSE2_KERNELS{"sse2", TAKYON_BANK_KERNELS(bankSse2)};
+const KernelSet AVX2_KERNELS{"avx2", TAKYON_BANK_KERNELS(bankAvx2)};
+#endif
+
+// Chosen once from the CPU; TAKYON_SIMD=scalar|sse2|avx2 forces a variant.
+const KernelSet &bankKernels() {
+  static const KernelSet &chosen = []() -> const KernelSet & {
+    const char *force = std::getenv("TAKYON_SIMD");
+    if (force && std::strcmp(force, "scalar") == 0)
+      return SCALAR_KERNELS;
+#ifdef TAKYON_X86
+    if (force && std::strcmp(force, "sse2") == 0)
+      return SSE2_KERNELS;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      return AVX2_KERNELS;
+    return SSE2_KERNELS;
+#else
+    return SCALAR_KERNELS;
+#endif
+  }();
+  return chosen;
+}
+
+// Deterministic pseudo-random phase in [0, 1) for partial k.
+float hashPhase(uint32_t k) {
+  k ^= k >> 16;
+  k *= 0x7feb352dU;
+  k ^= k >> 15;
+  k *= 0x846ca68bU;
+  k ^= k >> 16;
+  return static_cast<float>(k >> 8) / 16777216.0f;
+}
+
+} // namespace
+
+std::unique_ptr<OscillatorBank> OscillatorBank::init(float amp_, float freq_,
+                                                     int count_, float spread_,
+                                                     Waveform type_,
+                                                     BankMode mode_) {
+  auto bank = std::make_unique<OscillatorBank>();
+  bank->amp.set(amp_);
+  bank->freq.set(freq_);
+  bank->count.store(count_);
+  bank->spread.store(spread_);
+  bank->type = type_;
+  bank->mode = mode_;
+  bank->sinked.store(false);
+  bank->configure();
+  std::cout << "new OscillatorBank: count=" << count_ << " freq=" << freq_
+            << " kernels=" << bankKernels().name << std::endl;
+  return bank;
+}
+
+void OscillatorBank::reset() {
+  bool unison = mode.load(std::memory_order_relaxed) == BankMode::Unison;
+  for (int k = 0; k < activeCount; k++)
+    phases[k] = unison ? hashPhase(k) : 0.0f;
+}
+
+void OscillatorBank::adopt(const Node &previous) {
+  auto *p = dynamic_cast<const OscillatorBank *>(&previous);
+  if (!p)
+    return;
+  // partials already sounding keep their phase through the next rebuild
+  std::copy(p->phases, p->phases + MAX_PARTIALS, phases);
+  activeCount = p->activeCount;
+}
+
+void OscillatorBank::rebuild() {
+  int n = std::clamp(count.load(std::memory_order_relaxed), 1, MAX_PARTIALS);
+  float cents = spread.load(std::memory_order_relaxed);
+  BankMode m = mode.load(std::memory_order_relaxed);
+
+  for (int k = 0; k < MAX_PARTIALS; k++) {
+    if (k >= n) {
+      ratios[k] = 1.0f;
+      gains[k] = 0.0f;
+      continue;
+    }
+    if (m == BankMode::Unison) {
+      float pos = n > 1 ? static_cast<float>(k) / (n - 1) - 0.5f : 0.0f;
+      ratios[k] = exp2f(cents * pos / 1200.0f);
+      gains[k] = 1.0f / sqrtf(static_cast<float>(n));
+    } else {
+      ratios[k] = static_cast<float>(k + 1);
+      gains[k] = 2.0f / (PI_F * (k + 1));
+    }
+    // scatter newly enabled unison partials so they do not start in phase
+    if (k >= activeCount)
+      phases[k] = m == BankMode::Unison ? hashPhase(k) : 0.0f;
+  }
+  activeCount = n;
+}
+
+void OscillatorBank::process(const Block &block) {
+  const int frames = block.frames;
+
+  uint32_t v = version.load(std::memory_order_acquire);
+  if (v != seenVersion) {
+    seenVersion = v;
+    rebuild();
+  }
+
+  const ModParam::Snapshot a = amp.read();
+  const ModParam::Snapshot f = freq.read();
+  const float invRate = SampleRate::get().inv;
+
+  float inc[BLOCK_SIZE];
+  float maxInc = 0.0f;
+  for (int i = 0; i < frames; i++) {
+    inc[i] = f.at(i) * invRate;
+    maxInc = std::max(maxInc, fabsf(inc[i]));
+  }
+
+  // harmonic partials above Nyquist are skipped rather than aliased
+  int n = activeCount;
+  if (mode.load(std::memory_order_relaxed) == BankMode::Harmonic &&
+      maxInc > 0.0f)
+    n = std::min(n, static_cast<int>(0.5f / maxInc));
+
+  std::fill(out, out + frames, 0.0f);
+  int wf = static_cast<int>(type.load(std::memory_order_relaxed));
+  bankKernels().fn[wf](inc, frames, phases, ratios, gains, n, out);
+
+  for (int i = 0; i < frames; i++)
+    out[i] *= a.at(i);
+}
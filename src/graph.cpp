@@ -1,5 +1,37 @@
 #include "graph.h"
 
+#include <algorithm>
+#include <chrono>
+
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#endif
+
+namespace {
+
+// Remove every occurrence of `id`; order is not preserved.
+void eraseAll(std::vector<int> &list, int id) {
+  for (size_t i = 0; i < list.size();) {
+    if (list[i] == id) {
+      list[i] = list.back();
+      list.pop_back();
+    } else {
+      i++;
+    }
+  }
+}
+
+// Remove one occurrence of `id`; order is not preserved.
+void eraseOne(std::vector<int> &list, int id) {
+  auto it = std::find(list.begin(), list.end(), id);
+  if (it != list.end()) {
+    *it = list.back();
+    list.pop_back();
+  }
+}
+
+} // namespace
+
 int Graph::addNode(std::unique_ptr<Node> node) {
   // check if any unallocated node slots exist
   if (freeIDs.size() > 0) {
@@ -9,76 +41,547 @@ int Graph::addNode(std::unique_ptr<Node> node) {
     return id;
   } else {
 
-    // allocate new slot if all are used
+    // allocate new slot if all are used; an edgeless node can go last
+    int id = static_cast<int>(nodes.size());
     nodes.push_back(std::move(node));
+    generations.push_back(0);
     parents.push_back(std::vector<int>());
     children.push_back(std::vector<int>());
-    return nodes.size() - 1;
+    position.push_back(static_cast<int>(topoOrder.size()));
+    topoOrder.push_back(id);
+    visited.push_back(0);
+    return id;
   }
 }
 
 void Graph::removeNode(int id) {
-  nodes[id].reset();
-  freeIDs.push(id);
+  Node *node = nodes[id].get();
 
-  // iterate parents and remove this node ID
+  // Unhook block pointers held between this node and its neighbours. In
+  // an edit the live plan still renders both, so wait for commit(): by
+  // then a neighbour removed as well needs no unhooking at all.
   for (int pID : parents[id]) {
-    auto &sibs = children[pID];
-    sibs.erase(std::remove(sibs.begin(), sibs.end(), id), sibs.end());
+    if (editDepth > 0) {
+      editDetached.push_back({nodes[pID].get(), node});
+      continue;
+    }
+    nodes[pID]->detach(node);
+    node->detach(nodes[pID].get());
   }
-
-  // clear parents vector
-  parents[id].clear();
-
-  // iterate children and remove this node ID
   for (int cID : children[id]) {
-    auto &sibs = parents[cID];
-    sibs.erase(std::remove(sibs.begin(), sibs.end(), id), sibs.end());
+    if (editDepth > 0) {
+      editDetached.push_back({nodes[cID].get(), node});
+      continue;
+    }
+    nodes[cID]->detach(node);
+    node->detach(nodes[cID].get());
   }
 
-  // clear children vector
+  // keep the node alive until no callback can still be rendering it
+  std::unique_ptr<Node> removed = std::move(nodes[id]);
+  generations[id]++;
+  freeIDs.push(id);
+  sinkedNodes.erase(std::remove(sinkedNodes.begin(), sinkedNodes.end(), id),
+                    sinkedNodes.end());
+
+  // drop this node from its neighbours' lists; removal keeps the order valid
+  for (int pID : parents[id])
+    eraseAll(children[pID], id);
+  parents[id].clear();
+
+  for (int cID : children[id])
+    eraseAll(parents[cID], id);
   children[id].clear();
 
-  sort();
+  if (editDepth > 0) {
+    // the live plan may still render it; the edit's plan takes ownership
+    editRemoved.push_back(std::move(removed));
+    commit();
+    return;
+  }
+  commit();
+  retire(nullptr, std::move(removed));
 }
 
-void Graph::addEdge(int parent, int child) {
+bool Graph::addEdge(int parent, int child) {
+  if (parent == child)
+    return false;
+
+  int lower = position[child];
+  int upper = position[parent];
+  if (upper > lower) {
+    // Pearce-Kelly: only nodes positioned between child and parent can be
+    // out of order. Collect those reachable from child (must move after
+    // parent) and those reaching parent (must move before child).
+    forward.clear();
+    backward.clear();
+    bool acyclic = discoverForward(child, upper, parent);
+    if (acyclic) {
+      discoverBackward(parent, lower);
+      reorder();
+    }
+    for (int id : forward)
+      visited[id] = 0;
+    for (int id : backward)
+      visited[id] = 0;
+    if (!acyclic)
+      return false;
+  }
+
   parents[child].push_back(parent);
   children[parent].push_back(child);
+  return true;
+}
+
+void Graph::removeEdge(int parent, int child) {
+  eraseOne(parents[child], parent);
+  eraseOne(children[parent], child);
 }
 
-void Graph::sort() {
-  std::unordered_map<int, int> inDegree;
-  for (int i = 0; i < nodes.size(); i++) {
-    inDegree[i] = parents[i].size();
+bool Graph::hasEdge(int parent, int child) const {
+  const std::vector<int> &list = children[parent];
+  return std::find(list.begin(), list.end(), child) != list.end();
+}
+
+bool Graph::discoverForward(int from, int upper, int target) {
+  stack.clear();
+  stack.push_back(from);
+  visited[from] = 1;
+  while (!stack.empty()) {
+    int id = stack.back();
+    stack.pop_back();
+    forward.push_back(id);
+    for (int c : children[id]) {
+      if (c == target) {
+        // hand back everything marked so the caller can clear it
+        forward.insert(forward.end(), stack.begin(), stack.end());
+        return false;
+      }
+      if (!visited[c] && position[c] < upper) {
+        visited[c] = 1;
+        stack.push_back(c);
+      }
+    }
+  }
+  return true;
+}
+
+void Graph::discoverBackward(int from, int lower) {
+  stack.clear();
+  stack.push_back(from);
+  visited[from] = 1;
+  while (!stack.empty()) {
+    int id = stack.back();
+    stack.pop_back();
+    backward.push_back(id);
+    for (int p : parents[id]) {
+      if (!visited[p] && position[p] > lower) {
+        visited[p] = 1;
+        stack.push_back(p);
+      }
+    }
+  }
+}
+
+void Graph::reorder() {
+  auto byPosition = [this](int a, int b) { return position[a] < position[b]; };
+  std::sort(forward.begin(), forward.end(), byPosition);
+  std::sort(backward.begin(), backward.end(), byPosition);
+
+  // reuse the affected positions: ancestors of parent first, then the
+  // descendants of child, each group keeping its relative order
+  slots.clear();
+  for (int id : backward)
+    slots.push_back(position[id]);
+  for (int id : forward)
+    slots.push_back(position[id]);
+  std::sort(slots.begin(), slots.end());
+
+  size_t i = 0;
+  for (int id : backward) {
+    position[id] = slots[i];
+    topoOrder[slots[i++]] = id;
+  }
+  for (int id : forward) {
+    position[id] = slots[i];
+    topoOrder[slots[i++]] = id;
   }
+}
+
+void Graph::addSink(int id) {
+  if (std::find(sinkedNodes.begin(), sinkedNodes.end(), id) ==
+      sinkedNodes.end())
+    sinkedNodes.push_back(id);
+}
+
+void Graph::removeSink(int id) {
+  sinkedNodes.erase(std::remove(sinkedNodes.begin(), sinkedNodes.end(), id),
+                    sinkedNodes.end());
+}
 
-  std::queue<int> q;
-  for (auto &[node, deg] : inDegree) {
-    if (deg == 0)
-      q.push(node);
+void Graph::unlink(int a, int b) {
+  Node *x = nodes[a].get();
+  Node *y = nodes[b].get();
+  if (editDepth > 0) {
+    editDetached.push_back({x, y});
+    editDirty = true;
+    return;
   }
+  x->detach(y);
+  y->detach(x);
+}
 
-  std::vector<int> order;
-  while (!q.empty()) {
-    int node = q.front();
-    q.pop();
-    order.push_back(node);
+void Graph::setSource(const Node *owner, ModParam *param,
+                      const float *source) {
+  if (this->source(*param) == source)
+    return;
+  RenderPlan *live = livePlan.load();
+  bool waiting = live && !live->handedOff.load(std::memory_order_acquire) &&
+                 !live->rewires.empty();
+  if (editDepth == 0 && !waiting) {
+    param->source.store(source, std::memory_order_release);
+    return;
+  }
+  // queued behind the pending ones, which would otherwise undo it
+  editRewires.push_back({owner, param, source});
+  commit();
+}
 
-    for (int child : children[node]) {
-      inDegree[child]--;
-      if (inDegree[child] == 0) {
-        q.push(child);
+const float *Graph::source(const ModParam &param) const {
+  // the latest rewire of `param` still to come wins
+  auto pending = [&param](const std::vector<RenderPlan::Rewire> &rewires,
+                          const float *&found) {
+    for (auto it = rewires.rbegin(); it != rewires.rend(); ++it) {
+      if (it->param == &param) {
+        found = it->source;
+        return true;
       }
     }
+    return false;
+  };
+  const float *found = nullptr;
+  if (pending(editRewires, found))
+    return found;
+  const RenderPlan *live = livePlan.load();
+  if (live && !live->handedOff.load(std::memory_order_acquire) &&
+      pending(live->rewires, found))
+    return found;
+  return param.source.load(std::memory_order_relaxed);
+}
+
+Graph::~Graph() {
+  // the audio device is stopped before the graph goes away
+  delete livePlan.exchange(nullptr);
+}
+
+const std::vector<const Node *> &Node::audioInputs() const {
+  static const std::vector<const Node *> none;
+  return none;
+}
+
+void Graph::beginEdit() { editDepth++; }
+
+void Graph::endEdit() {
+  if (--editDepth > 0 || !editDirty)
+    return;
+  commit();
+}
+
+void Graph::handOff(int previous, int next) {
+  if (previous == next || !nodes[previous] || !nodes[next])
+    return;
+  editHandoffs.push_back({nodes[next].get(), nodes[previous].get()});
+}
+
+void Graph::commit() {
+  if (editDepth > 0) {
+    editDirty = true;
+    return;
+  }
+  editDirty = false;
+
+  // Links between two nodes the edit removed stay as they are: the old
+  // plan keeps rendering modulation through them until the swap, and
+  // neither node renders after it. Links to a survivor must go before its
+  // inputs are read below.
+  if (!editDetached.empty()) {
+    std::vector<const Node *> gone;
+    for (const std::unique_ptr<Node> &r : editRemoved)
+      gone.push_back(r.get());
+    std::sort(gone.begin(), gone.end(), std::less<const Node *>());
+    auto removed = [&gone](const Node *n) {
+      return std::binary_search(gone.begin(), gone.end(), n,
+                                std::less<const Node *>());
+    };
+    for (const auto &[a, b] : editDetached) {
+      if (removed(a) && removed(b))
+        continue;
+      a->detach(b);
+      b->detach(a);
+    }
+    editDetached.clear();
+  }
+
+  // Controllers fed only by controllers render in the first phase. A
+  // target reads their finished block, so edges out of that phase order
+  // the phases but need not share a task; one LFO over every voice would
+  // otherwise make the whole patch a single task.
+  std::vector<char> early(nodes.size(), 0);
+  for (int id : topoOrder) {
+    if (!nodes[id] || !nodes[id]->isControl())
+      continue;
+    early[id] = std::all_of(parents[id].begin(), parents[id].end(),
+                            [&early](int p) { return early[p]; });
+  }
+
+  // union-find over the remaining edges: each root names one task
+  std::vector<int> root(nodes.size());
+  for (size_t i = 0; i < root.size(); i++)
+    root[i] = static_cast<int>(i);
+  auto find = [&root](int x) {
+    while (root[x] != x)
+      x = root[x] = root[root[x]];
+    return x;
+  };
+  for (size_t id = 0; id < nodes.size(); id++) {
+    for (int p : parents[id])
+      if (early[p] == early[id])
+        root[find(static_cast<int>(id))] = find(p);
+  }
+
+  // bucket nodes by component, each bucket in topological order
+  std::vector<int> component(nodes.size(), -1);
+  std::vector<std::vector<int>> members;
+  for (int id : topoOrder) {
+    if (!nodes[id])
+      continue;
+    int r = find(id);
+    if (component[r] < 0) {
+      component[r] = static_cast<int>(members.size());
+      members.emplace_back();
+    }
+    members[component[r]].push_back(id);
+  }
+  // Within a component, any order that keeps each node after its parents
+  // is valid. Ordering by depth and then by address makes the walk run
+  // through each type's slabs (pool.h) in memory order, whatever order
+  // the nodes were created or their slots reused in.
+  std::vector<int> depth(nodes.size(), 0);
+  for (auto &ids : members) {
+    for (int id : ids)
+      for (int p : parents[id])
+        depth[id] = std::max(depth[id], depth[p] + 1);
+    std::sort(ids.begin(), ids.end(), [&](int a, int b) {
+      if (depth[a] != depth[b])
+        return depth[a] < depth[b];
+      return std::less<const Node *>()(nodes[a].get(), nodes[b].get());
+    });
+  }
+
+  // controllers first, then largest first so workers start on the long
+  // tasks
+  std::stable_sort(members.begin(), members.end(),
+                   [&early](const std::vector<int> &a,
+                            const std::vector<int> &b) {
+                     if (early[a[0]] != early[b[0]])
+                       return early[a[0]] > early[b[0]];
+                     return a.size() > b.size();
+                   });
+
+  auto plan = std::make_unique<RenderPlan>();
+  plan->steps.reserve(topoOrder.size());
+  plan->tasks.reserve(members.size());
+
+  // Fuse producer -> consumer pairs where each is the other's only link
+  // (osc -> filter in every builder chain). The producer moves down to
+  // render just before its consumer, whose other parents are all earlier.
+  std::vector<int> fusedFrom(nodes.size(), -1);
+  for (int id : topoOrder) {
+    if (!nodes[id] || children[id].size() != 1)
+      continue;
+    int c = children[id][0];
+    const auto &ins = nodes[c]->audioInputs();
+    if (ins.size() == 1 && ins[0] == nodes[id].get() &&
+        nodes[id]->fusesWith(*nodes[c]))
+      fusedFrom[c] = id;
+  }
+
+  auto pushStep = [&](Node *node, bool fuseNext) {
+    const auto &ins = node->audioInputs();
+    plan->steps.push_back({node, static_cast<int>(plan->inputs.size()),
+                           static_cast<int>(ins.size()), fuseNext});
+    for (const Node *in : ins) {
+      plan->inputs.push_back(in->out);
+      plan->inputNodes.push_back(in);
+    }
+  };
+  for (const auto &ids : members) {
+    plan->controlTasks += early[ids[0]];
+    plan->tasks.push_back({static_cast<int>(plan->steps.size()),
+                           static_cast<int>(ids.size())});
+    for (int id : ids) {
+      bool fused = children[id].size() == 1 && fusedFrom[children[id][0]] == id;
+      if (fused)
+        continue; // emitted with its consumer
+      if (fusedFrom[id] >= 0)
+        pushStep(nodes[fusedFrom[id]].get(), true);
+      pushStep(nodes[id].get(), false);
+    }
+  }
+
+  for (int id : sinkedNodes) {
+    if (nodes[id])
+      plan->sinks.push_back(nodes[id].get());
   }
 
-  if (order.size() != nodes.size())
-    throw std::runtime_error("Graph has cycles!");
+  // Rewires of a plan replaced before the audio thread acquired it go
+  // first, minus those of nodes removed since; applying one twice is
+  // harmless, as the later ones follow in order.
+  RenderPlan *live = livePlan.load();
+  if (live && !live->handedOff.load(std::memory_order_acquire) &&
+      !live->rewires.empty()) {
+    std::vector<const Node *> alive;
+    for (const std::unique_ptr<Node> &n : nodes)
+      if (n)
+        alive.push_back(n.get());
+    std::sort(alive.begin(), alive.end(), std::less<const Node *>());
+    std::vector<RenderPlan::Rewire> carried;
+    for (const RenderPlan::Rewire &r : live->rewires)
+      if (std::binary_search(alive.begin(), alive.end(), r.owner,
+                             std::less<const Node *>()))
+        carried.push_back(r);
+    editRewires.insert(editRewires.begin(), carried.begin(), carried.end());
+  }
+
+  plan->handoffs = std::move(editHandoffs);
+  plan->replaced = std::move(editRemoved);
+  plan->rewires = std::move(editRewires);
+  editHandoffs.clear();
+  editRemoved.clear();
+  editRewires.clear();
+
+  std::unique_ptr<RenderPlan> old(livePlan.exchange(plan.release()));
+  retire(std::move(old), nullptr);
+}
+
+std::atomic<bool> RenderPlan::timing{false};
+std::atomic<bool> RenderPlan::fusion{true};
+
+void RenderPlan::flushDenormals() {
+#if defined(__SSE__) || defined(__x86_64__)
+  _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ | DAZ
+#elif defined(__aarch64__)
+  uint64_t fpcr;
+  __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+  __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1u << 24))); // FZ
+#endif
+}
+
+void RenderPlan::runTask(const Task &task, int frames) const {
+  using clock = std::chrono::steady_clock;
+  // weight of the newest block in Node::cost
+  constexpr float COST_SMOOTHING = 1.0f / 64.0f;
+
+  const bool timed = timing.load(std::memory_order_relaxed);
+  // timed blocks render pairs apart so each node keeps its own cost
+  const bool fuse = !timed && fusion.load(std::memory_order_relaxed);
+  Block block;
+  block.frames = frames;
+  for (int s = task.firstStep; s < task.firstStep + task.numSteps; s++) {
+    const Step &step = steps[s];
+    Node *node = step.node;
+    if (!node->active.load(std::memory_order_relaxed)) {
+      // parked voice: keep its output silent for anything reading it
+      if (!node->silent) {
+        std::fill(node->out, node->out + BLOCK_SIZE, 0.0f);
+        node->silent = true;
+      }
+      continue;
+    }
+    block.inputs = inputs.data() + step.firstInput;
+    block.numInputs = step.numInputs;
+    bool inputsSilent = true;
+    for (int i = 0; i < step.numInputs; i++)
+      inputsSilent &= inputNodes[step.firstInput + i]->silent;
+    if (node->sleeps(block, inputsSilent)) {
+      if (!node->silent) {
+        std::fill(node->out, node->out + BLOCK_SIZE, 0.0f);
+        node->silent = true;
+      }
+      if (timed) {
+        float cost = node->cost.load(std::memory_order_relaxed);
+        node->cost.store(cost - cost * COST_SMOOTHING,
+                         std::memory_order_relaxed);
+      }
+      continue;
+    }
+    node->silent = false;
+    if (step.fuseNext && fuse &&
+        steps[s + 1].node->active.load(std::memory_order_relaxed)) {
+      Node *next = steps[++s].node;
+      next->silent = false;
+      node->processFused(block, *next);
+      continue;
+    }
+    if (!timed) {
+      node->process(block);
+      continue;
+    }
+
+    auto start = clock::now();
+    node->process(block);
+    float nanos = std::chrono::duration<float, std::nano>(clock::now() - start)
+                      .count();
+    float cost = node->cost.load(std::memory_order_relaxed);
+    cost += (nanos / frames - cost) * COST_SMOOTHING;
+    node->cost.store(cost, std::memory_order_relaxed);
+  }
+}
+
+void Graph::retire(std::unique_ptr<RenderPlan> plan,
+                   std::unique_ptr<Node> node) {
+  collectGarbage();
+
+  // Read after the swap: an even epoch means no callback is in flight, so
+  // the next one is guaranteed to see the new plan and we can free now.
+  uint64_t epoch = renderEpoch.load();
+  if ((epoch & 1) == 0 || (!plan && !node))
+    return;
+  retired.push_back({epoch, std::move(plan), std::move(node)});
+}
 
-  topoOrder = order;
+void Graph::collectGarbage() {
+  uint64_t now = renderEpoch.load();
+  retired.erase(std::remove_if(retired.begin(), retired.end(),
+                               [now](const Retired &r) {
+                                 return r.epoch != now;
+                               }),
+                retired.end());
 }
 
+const RenderPlan *Graph::acquirePlan() {
+  renderEpoch.fetch_add(1);
+  RenderPlan *plan = livePlan.load();
+  if (plan && !plan->handedOff.load(std::memory_order_relaxed)) {
+    for (const RenderPlan::Rewire &r : plan->rewires)
+      r.param->source.store(r.source, std::memory_order_relaxed);
+    // predecessors stopped rendering with the previous plan: state is final
+    for (const RenderPlan::Handoff &h : plan->handoffs) {
+      h.next->adopt(*h.previous);
+      // no fade-in on the bus for a sink that was already sounding
+      h.next->busGain[0] = h.previous->busGain[0];
+      h.next->busGain[1] = h.previous->busGain[1];
+    }
+    plan->handedOff.store(true, std::memory_order_release);
+  }
+  return plan;
+}
+
+void Graph::releasePlan() { renderEpoch.fetch_add(1); }
+
 std::vector<std::unique_ptr<Node>> &Graph::getNodes() { return nodes; }
-std::vector<int> &Graph::getTopoOrder() { return topoOrder; }
-std::vector<int> &Graph::getSinkedNodes() { return sinkedNodes; }
+const std::vector<int> &Graph::getChildren(int id) const {
+  return children[id];
+}
+const std::vector<int> &Graph::getTopoOrder() const { return topoOrder; }
+const std::vector<int> &Graph::getSinkedNodes() const { return sinkedNodes; }
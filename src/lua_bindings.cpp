@@ -2,10 +2,14 @@
 
 #include "globals.h"
 #include "nodes.h"
+#include "rate.h"
+#include "sequencer.h"
 
 #include <algorithm>
 #include <cmath>
 #include <cstring>
+#include <type_traits>
+#include <vector>
 
 extern "C" {
 #include <lauxlib.h>
@@ -17,17 +21,38 @@ namespace {
 constexpr const char *OSC_MT = "takyon.osc";
 constexpr const char *LFO_MT = "takyon.lfo";
 constexpr const char *FILTER_MT = "takyon.filter";
+constexpr const char *BANK_MT = "takyon.bank";
 constexpr const char *BUILDER_MT = "takyon.sound_builder";
+constexpr const char *BOUND_METHODS_KEY = "takyon.bound_methods";
+constexpr const char *WAVETABLE_MT = "takyon.wavetable";
+
+// Node types a handle can name; checked in place of dynamic_cast.
+enum class NodeTag : uint8_t { Oscillator, Bank, LFO, Filter };
+
+// Graph slot plus the generation it was filled in, so a handle to a
+// removed node stays invalid even after its slot is reused.
+struct NodeRef {
+  int id = -1;
+  uint32_t generation = 0;
+  NodeTag tag = NodeTag::Oscillator;
+};
 
 struct LuaNodeHandle {
   LuaContext *ctx{};
-  int nodeId = -1;
+  NodeRef ref;
 };
 
 struct LuaSoundBuilder {
   LuaContext *ctx{};
-  int sourceId = -1;  // oscillator or initial audio node
-  int currentId = -1; // tip of the effect chain
+  NodeRef source;  // oscillator or initial audio node
+  NodeRef current; // tip of the effect chain
+  // Bus settings of the chain, written to whichever node is its tip. Kept
+  // here rather than read back from the tip, which on reload may be an
+  // old node still carrying the previous run's settings.
+  float gain = 1.0f;
+  float pan = 0.0f;
+  bool mute = false;
+  bool solo = false;
 };
 
 LuaContext *getCtx(lua_State *L) {
@@ -41,52 +66,98 @@ int call_with_self(lua_State *L) {
   return method(L);
 }
 
-int push_method_closure(lua_State *L, const char *mtName) {
-  const char *field = luaL_checkstring(L, 2);
-
-  luaL_getmetatable(L, mtName);       // mt
-  lua_getfield(L, -1, "__methods");   // mt, methods
-  lua_getfield(L, -1, field);         // mt, methods, method
+// __index for handles: `h.freq` is the `freq` method bound to `h`, so the
+// dot chains patches are written in work. Upvalue 1 is the metatable's
+// method table, upvalue 2 the weak-keyed cache of each handle's bound
+// methods: a closure is made on a handle's first access to a method, and
+// later calls reuse it without allocating.
+int index_method(lua_State *L) {
+  lua_pushvalue(L, 1);
+  if (lua_rawget(L, lua_upvalueindex(2)) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    lua_createtable(L, 0, 4);
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, lua_upvalueindex(2));
+  }
+  lua_pushvalue(L, 2); // self, key, bound, key
+  if (lua_rawget(L, -2) == LUA_TFUNCTION)
+    return 1;
+  lua_pop(L, 1);
 
-  if (!lua_iscfunction(L, -1)) {
-    lua_pop(L, 3);
+  lua_pushvalue(L, 2);
+  if (lua_rawget(L, lua_upvalueindex(1)) != LUA_TFUNCTION) {
     lua_pushnil(L);
     return 1;
   }
-
-  lua_remove(L, -2); // remove methods
-  lua_remove(L, -2); // remove metatable, stack now: method
-
   lua_pushvalue(L, 1); // method, self
   lua_pushcclosure(L, call_with_self, 2);
+  lua_pushvalue(L, 2);
+  lua_pushvalue(L, -2);
+  lua_rawset(L, -4); // bound[key] = closure
   return 1;
 }
 
+// Replaces the method table on top of the stack with the __index closure
+// over it. Every handle type shares one cache: its keys are the handles,
+// so a collected handle drops its bound methods with it.
+void pushIndexMethod(lua_State *L) {
+  if (!luaL_getsubtable(L, LUA_REGISTRYINDEX, BOUND_METHODS_KEY)) {
+    lua_createtable(L, 0, 1);
+    lua_pushliteral(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+  }
+  lua_pushcclosure(L, index_method, 2);
+}
+
 Graph &getGraphOrThrow(lua_State *L, LuaContext *ctx) {
   if (!ctx || !ctx->graph)
     luaL_error(L, "Graph is not available");
   return *ctx->graph;
 }
 
+// Whether a node tagged `tag` is a T.
+template <typename T> bool hasTag(NodeTag tag) {
+  if constexpr (std::is_same_v<T, Oscillator>)
+    return tag == NodeTag::Oscillator;
+  else if constexpr (std::is_same_v<T, OscillatorBank>)
+    return tag == NodeTag::Bank;
+  else if constexpr (std::is_same_v<T, SourceNode>)
+    return tag == NodeTag::Oscillator || tag == NodeTag::Bank;
+  else if constexpr (std::is_base_of_v<ControlNode, T>)
+    return tag == NodeTag::LFO;
+  else if constexpr (std::is_base_of_v<EffectNode, T>)
+    return tag == NodeTag::Filter;
+  else
+    return true;
+}
+
+NodeRef makeRef(Graph &graph, int id, NodeTag tag) {
+  return {id, graph.generation(id), tag};
+}
+
 template <typename T>
-T *getNodeAs(lua_State *L, Graph &graph, int nodeId, const char *typeName) {
+T *resolve(lua_State *L, LuaContext *ctx, const NodeRef &ref,
+           const char *typeName) {
+  Graph &graph = getGraphOrThrow(L, ctx);
   auto &nodes = graph.getNodes();
-  if (nodeId < 0 || nodeId >= static_cast<int>(nodes.size()) ||
-      nodes[nodeId] == nullptr) {
+  if (ref.id < 0 || ref.id >= static_cast<int>(nodes.size()) ||
+      nodes[ref.id] == nullptr ||
+      graph.generation(ref.id) != ref.generation) {
     luaL_error(L, "Invalid %s handle", typeName);
   }
-  auto *typed = dynamic_cast<T *>(nodes[nodeId].get());
-  if (!typed)
+  if (!hasTag<T>(ref.tag))
     luaL_error(L, "Handle is not a %s", typeName);
-  return typed;
+  return static_cast<T *>(nodes[ref.id].get());
 }
 
-LuaNodeHandle *pushNodeHandle(lua_State *L, LuaContext *ctx, int nodeId,
-                              const char *mtName) {
+LuaNodeHandle *pushNodeHandle(lua_State *L, LuaContext *ctx,
+                              const NodeRef &ref, const char *mtName) {
   auto *handle =
       static_cast<LuaNodeHandle *>(lua_newuserdata(L, sizeof(LuaNodeHandle)));
   handle->ctx = ctx;
-  handle->nodeId = nodeId;
+  handle->ref = ref;
   luaL_getmetatable(L, mtName);
   lua_setmetatable(L, -2);
   return handle;
@@ -97,12 +168,11 @@ LuaNodeHandle *checkNodeHandle(lua_State *L, int index,
   return static_cast<LuaNodeHandle *>(luaL_checkudata(L, index, mtName));
 }
 
-LuaSoundBuilder *pushBuilder(lua_State *L, LuaContext *ctx, int sourceId) {
+LuaSoundBuilder *pushBuilder(lua_State *L, LuaContext *ctx,
+                             const NodeRef &source) {
   auto *builder = static_cast<LuaSoundBuilder *>(
       lua_newuserdata(L, sizeof(LuaSoundBuilder)));
-  builder->ctx = ctx;
-  builder->sourceId = sourceId;
-  builder->currentId = sourceId;
+  *builder = LuaSoundBuilder{ctx, source, source};
   luaL_getmetatable(L, BUILDER_MT);
   lua_setmetatable(L, -2);
   return builder;
@@ -123,31 +193,68 @@ Waveform toWaveform(lua_State *L, int index) {
   return static_cast<Waveform>(wf);
 }
 
+Interpolation toInterpolation(lua_State *L, int index) {
+  int mode = static_cast<int>(luaL_checkinteger(L, index));
+  if (mode != static_cast<int>(Interpolation::Linear) &&
+      mode != static_cast<int>(Interpolation::Cubic)) {
+    luaL_error(L, "Invalid interpolation mode %d", mode);
+  }
+  return static_cast<Interpolation>(mode);
+}
+
+// Waveform id or user wavetable handle
+void setOscShape(lua_State *L, Oscillator *osc, int index) {
+  if (auto **wt = static_cast<const Wavetable **>(
+          luaL_testudata(L, index, WAVETABLE_MT))) {
+    osc->table.store(*wt, std::memory_order_relaxed);
+    return;
+  }
+  osc->type.store(toWaveform(L, index), std::memory_order_relaxed);
+  osc->table.store(nullptr, std::memory_order_relaxed);
+}
+
 bool isControlHandle(lua_State *L, int index) {
   return luaL_testudata(L, index, LFO_MT) != nullptr;
 }
 
-void attachControl(lua_State *L, LuaNodeHandle *owner, int ownerId,
-                   atomic<float> &param, int controlIndex) {
+void attachControl(lua_State *L, LuaNodeHandle *owner, ModParam &param,
+                   int controlIndex) {
   auto *controlHandle =
       static_cast<LuaNodeHandle *>(luaL_checkudata(L, controlIndex, LFO_MT));
   auto *ctx = owner->ctx;
   Graph &graph = getGraphOrThrow(L, ctx);
-  auto *control =
-      getNodeAs<ControlNode>(L, graph, controlHandle->nodeId, "control node");
-  control->addTarget(&param);
-  graph.addEdge(controlHandle->nodeId, ownerId);
+  auto *control = resolve<ControlNode>(L, ctx, controlHandle->ref,
+                                       "control node");
+  Node *target = resolve<Node>(L, ctx, owner->ref, "node");
+  if (!graph.hasEdge(controlHandle->ref.id, owner->ref.id) &&
+      !graph.addEdge(controlHandle->ref.id, owner->ref.id))
+    luaL_error(L, "Cannot modulate: connection would create a cycle");
+  control->addTarget(&param, target);
+  graph.setSource(target, &param, control->out);
 }
 
-void setScalarOrControl(lua_State *L, LuaNodeHandle *owner,
-                        atomic<float> &param, int valueIndex,
-                        bool allowControl) {
+// Returns true if a controller was attached, which needs a commit.
+bool setScalarOrControl(lua_State *L, LuaNodeHandle *owner, ModParam &param,
+                        int valueIndex, bool allowControl) {
   if (allowControl && isControlHandle(L, valueIndex)) {
-    attachControl(L, owner, owner->nodeId, param, valueIndex);
-    return;
+    attachControl(L, owner, param, valueIndex);
+    return true;
   }
   float value = static_cast<float>(luaL_checknumber(L, valueIndex));
-  param.store(value, std::memory_order_relaxed);
+  param.value.store(value, std::memory_order_relaxed);
+  Graph &graph = getGraphOrThrow(L, owner->ctx);
+  if (graph.source(param))
+    graph.setSource(resolve<Node>(L, owner->ctx, owner->ref, "node"), &param,
+                    nullptr);
+  return false;
+}
+
+// Publish the controllers a call attached, once for all of its
+// parameters, so each runs ahead of its new targets. A call that raises
+// part-way leaves its attachments to the next commit.
+void commitIf(lua_State *L, LuaContext *ctx, bool attached) {
+  if (attached)
+    getGraphOrThrow(L, ctx).commit();
 }
 
 void registerWaveformGlobals(lua_State *L) {
@@ -162,6 +269,16 @@ void registerWaveformGlobals(lua_State *L) {
   lua_pushinteger(L, static_cast<int>(Waveform::Triangle));
   lua_setglobal(L, "Triangle");
 
+  lua_pushinteger(L, static_cast<int>(BankMode::Unison));
+  lua_setglobal(L, "Unison");
+  lua_pushinteger(L, static_cast<int>(BankMode::Harmonic));
+  lua_setglobal(L, "Harmonic");
+
+  lua_pushinteger(L, static_cast<int>(Interpolation::Linear));
+  lua_setglobal(L, "Linear");
+  lua_pushinteger(L, static_cast<int>(Interpolation::Cubic));
+  lua_setglobal(L, "Cubic");
+
   constexpr double PI = 3.14159265358979323846;
   lua_pushnumber(L, static_cast<lua_Number>(PI));
   lua_setglobal(L, "PI");
@@ -171,28 +288,34 @@ void registerWaveformGlobals(lua_State *L) {
 
 int osc_freq(lua_State *L) {
   auto *handle = checkNodeHandle(L, 1, OSC_MT);
-  Graph &graph = getGraphOrThrow(L, handle->ctx);
-  auto *osc = getNodeAs<Oscillator>(L, graph, handle->nodeId, "oscillator");
-  setScalarOrControl(L, handle, osc->freq, 2, true);
+  auto *osc = resolve<Oscillator>(L, handle->ctx, handle->ref, "oscillator");
+  commitIf(L, handle->ctx,
+           setScalarOrControl(L, handle, osc->freq, 2, true));
   lua_settop(L, 1);
   return 1;
 }
 
 int osc_amp(lua_State *L) {
   auto *handle = checkNodeHandle(L, 1, OSC_MT);
-  Graph &graph = getGraphOrThrow(L, handle->ctx);
-  auto *osc = getNodeAs<Oscillator>(L, graph, handle->nodeId, "oscillator");
-  setScalarOrControl(L, handle, osc->amp, 2, true);
+  auto *osc = resolve<Oscillator>(L, handle->ctx, handle->ref, "oscillator");
+  commitIf(L, handle->ctx,
+           setScalarOrControl(L, handle, osc->amp, 2, true));
   lua_settop(L, 1);
   return 1;
 }
 
 int osc_type(lua_State *L) {
   auto *handle = checkNodeHandle(L, 1, OSC_MT);
-  Graph &graph = getGraphOrThrow(L, handle->ctx);
-  auto *osc = getNodeAs<Oscillator>(L, graph, handle->nodeId, "oscillator");
-  Waveform wf = toWaveform(L, 2);
-  osc->type.store(wf, std::memory_order_relaxed);
+  auto *osc = resolve<Oscillator>(L, handle->ctx, handle->ref, "oscillator");
+  setOscShape(L, osc, 2);
+  lua_settop(L, 1);
+  return 1;
+}
+
+int osc_interp(lua_State *L) {
+  auto *handle = checkNodeHandle(L, 1, OSC_MT);
+  auto *osc = resolve<Oscillator>(L, handle->ctx, handle->ref, "oscillator");
+  osc->interp.store(toInterpolation(L, 2), std::memory_order_relaxed);
   lua_settop(L, 1);
   return 1;
 }
@@ -218,20 +341,26 @@ int osc_newindex(lua_State *L) {
     lua_replace(L, 2);
     return osc_type(L);
   }
+  if (std::strcmp(field, "interp") == 0) {
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, 3);
+    lua_replace(L, 2);
+    return osc_interp(L);
+  }
   return luaL_error(L, "unknown oscillator field '%s'", field);
 }
 
-const luaL_Reg oscMethods[] = {
-    {"freq", osc_freq}, {"amp", osc_amp}, {"type", osc_type}, {nullptr, nullptr}};
-
-int osc_index(lua_State *L) { return push_method_closure(L, OSC_MT); }
+const luaL_Reg oscMethods[] = {{"freq", osc_freq},
+                               {"amp", osc_amp},
+                               {"type", osc_type},
+                               {"interp", osc_interp},
+                               {nullptr, nullptr}};
 
 void createOscMetatable(lua_State *L) {
   if (luaL_newmetatable(L, OSC_MT)) {
     lua_newtable(L);
     luaL_setfuncs(L, oscMethods, 0);
-    lua_setfield(L, -2, "__methods");
-    lua_pushcfunction(L, osc_index);
+    pushIndexMethod(L);
     lua_setfield(L, -2, "__index");
     lua_pushcfunction(L, osc_newindex);
     lua_setfield(L, -2, "__newindex");
@@ -243,50 +372,65 @@ void createOscMetatable(lua_State *L) {
 
 int lfo_base(lua_State *L) {
   auto *handle = checkNodeHandle(L, 1, LFO_MT);
-  Graph &graph = getGraphOrThrow(L, handle->ctx);
-  auto *lfo = getNodeAs<LFO>(L, graph, handle->nodeId, "lfo");
-  setScalarOrControl(L, handle, lfo->base, 2, true);
+  auto *lfo = resolve<LFO>(L, handle->ctx, handle->ref, "lfo");
+  commitIf(L, handle->ctx,
+           setScalarOrControl(L, handle, lfo->base, 2, true));
   lua_settop(L, 1);
   return 1;
 }
 
 int lfo_amp(lua_State *L) {
   auto *handle = checkNodeHandle(L, 1, LFO_MT);
-  Graph &graph = getGraphOrThrow(L, handle->ctx);
-  auto *lfo = getNodeAs<LFO>(L, graph, handle->nodeId, "lfo");
-  setScalarOrControl(L, handle, lfo->amp, 2, true);
+  auto *lfo = resolve<LFO>(L, handle->ctx, handle->ref, "lfo");
+  commitIf(L, handle->ctx,
+           setScalarOrControl(L, handle, lfo->amp, 2, true));
   lua_settop(L, 1);
   return 1;
 }
 
 int lfo_freq(lua_State *L) {
   auto *handle = checkNodeHandle(L, 1, LFO_MT);
-  Graph &graph = getGraphOrThrow(L, handle->ctx);
-  auto *lfo = getNodeAs<LFO>(L, graph, handle->nodeId, "lfo");
-  setScalarOrControl(L, handle, lfo->freq, 2, true);
+  auto *lfo = resolve<LFO>(L, handle->ctx, handle->ref, "lfo");
+  commitIf(L, handle->ctx,
+           setScalarOrControl(L, handle, lfo->freq, 2, true));
   lua_settop(L, 1);
   return 1;
 }
 
 int lfo_shift(lua_State *L) {
   auto *handle = checkNodeHandle(L, 1, LFO_MT);
-  Graph &graph = getGraphOrThrow(L, handle->ctx);
-  auto *lfo = getNodeAs<LFO>(L, graph, handle->nodeId, "lfo");
-  setScalarOrControl(L, handle, lfo->shift, 2, true);
+  auto *lfo = resolve<LFO>(L, handle->ctx, handle->ref, "lfo");
+  commitIf(L, handle->ctx,
+           setScalarOrControl(L, handle, lfo->shift, 2, true));
   lua_settop(L, 1);
   return 1;
 }
 
 int lfo_type(lua_State *L) {
   auto *handle = checkNodeHandle(L, 1, LFO_MT);
-  Graph &graph = getGraphOrThrow(L, handle->ctx);
-  auto *lfo = getNodeAs<LFO>(L, graph, handle->nodeId, "lfo");
+  auto *lfo = resolve<LFO>(L, handle->ctx, handle->ref, "lfo");
   Waveform wf = toWaveform(L, 2);
   lfo->type.store(wf, std::memory_order_relaxed);
   lua_settop(L, 1);
   return 1;
 }
 
+int checkDecimation(lua_State *L, int index, int min) {
+  lua_Integer d = luaL_checkinteger(L, index);
+  if (d < min || d > ControlNode::MAX_DECIMATION)
+    luaL_error(L, "decimation must be %d..%d", min,
+               ControlNode::MAX_DECIMATION);
+  return static_cast<int>(d);
+}
+
+int lfo_decimation(lua_State *L) {
+  auto *handle = checkNodeHandle(L, 1, LFO_MT);
+  auto *lfo = resolve<LFO>(L, handle->ctx, handle->ref, "lfo");
+  lfo->decimation.store(checkDecimation(L, 2, 0), std::memory_order_relaxed);
+  lua_settop(L, 1);
+  return 1;
+}
+
 int lfo_newindex(lua_State *L) {
   auto *handle = checkNodeHandle(L, 1, LFO_MT);
   const char *field = luaL_checkstring(L, 2);
@@ -320,21 +464,28 @@ int lfo_newindex(lua_State *L) {
     lua_replace(L, 2);
     return lfo_type(L);
   }
+  if (std::strcmp(field, "decimation") == 0) {
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, 3);
+    lua_replace(L, 2);
+    return lfo_decimation(L);
+  }
   return luaL_error(L, "unknown LFO field '%s'", field);
 }
 
-const luaL_Reg lfoMethods[] = {{"base", lfo_base},   {"amp", lfo_amp},
-                               {"freq", lfo_freq},   {"shift", lfo_shift},
-                               {"type", lfo_type},   {nullptr, nullptr}};
-
-int lfo_index(lua_State *L) { return push_method_closure(L, LFO_MT); }
+const luaL_Reg lfoMethods[] = {{"base", lfo_base},
+                               {"amp", lfo_amp},
+                               {"freq", lfo_freq},
+                               {"shift", lfo_shift},
+                               {"type", lfo_type},
+                               {"decimation", lfo_decimation},
+                               {nullptr, nullptr}};
 
 void createLfoMetatable(lua_State *L) {
   if (luaL_newmetatable(L, LFO_MT)) {
     lua_newtable(L);
     luaL_setfuncs(L, lfoMethods, 0);
-    lua_setfield(L, -2, "__methods");
-    lua_pushcfunction(L, lfo_index);
+    pushIndexMethod(L);
     lua_setfield(L, -2, "__index");
     lua_pushcfunction(L, lfo_newindex);
     lua_setfield(L, -2, "__newindex");
@@ -346,18 +497,18 @@ void createLfoMetatable(lua_State *L) {
 
 int filter_cutoff(lua_State *L) {
   auto *handle = checkNodeHandle(L, 1, FILTER_MT);
-  Graph &graph = getGraphOrThrow(L, handle->ctx);
-  auto *filter = getNodeAs<Filter>(L, graph, handle->nodeId, "filter");
-  setScalarOrControl(L, handle, filter->cutoff, 2, true);
+  auto *filter = resolve<Filter>(L, handle->ctx, handle->ref, "filter");
+  commitIf(L, handle->ctx,
+           setScalarOrControl(L, handle, filter->cutoff, 2, true));
   lua_settop(L, 1);
   return 1;
 }
 
 int filter_q(lua_State *L) {
   auto *handle = checkNodeHandle(L, 1, FILTER_MT);
-  Graph &graph = getGraphOrThrow(L, handle->ctx);
-  auto *filter = getNodeAs<Filter>(L, graph, handle->nodeId, "filter");
-  setScalarOrControl(L, handle, filter->q, 2, true);
+  auto *filter = resolve<Filter>(L, handle->ctx, handle->ref, "filter");
+  commitIf(L, handle->ctx,
+           setScalarOrControl(L, handle, filter->q, 2, true));
   lua_settop(L, 1);
   return 1;
 }
@@ -383,14 +534,11 @@ int filter_newindex(lua_State *L) {
 const luaL_Reg filterMethods[] = {
     {"cutoff", filter_cutoff}, {"q", filter_q}, {nullptr, nullptr}};
 
-int filter_index(lua_State *L) { return push_method_closure(L, FILTER_MT); }
-
 void createFilterMetatable(lua_State *L) {
   if (luaL_newmetatable(L, FILTER_MT)) {
     lua_newtable(L);
     luaL_setfuncs(L, filterMethods, 0);
-    lua_setfield(L, -2, "__methods");
-    lua_pushcfunction(L, filter_index);
+    pushIndexMethod(L);
     lua_setfield(L, -2, "__index");
     lua_pushcfunction(L, filter_newindex);
     lua_setfield(L, -2, "__newindex");
@@ -398,38 +546,141 @@ void createFilterMetatable(lua_State *L) {
   lua_pop(L, 1);
 }
 
+// --- Oscillator bank methods ------------------------------------------------
+
+OscillatorBank *checkBank(lua_State *L, LuaNodeHandle **handleOut = nullptr) {
+  auto *handle = checkNodeHandle(L, 1, BANK_MT);
+  if (handleOut)
+    *handleOut = handle;
+  return resolve<OscillatorBank>(L, handle->ctx, handle->ref, "bank");
+}
+
+BankMode toBankMode(lua_State *L, int index) {
+  int m = static_cast<int>(luaL_checkinteger(L, index));
+  if (m != static_cast<int>(BankMode::Unison) &&
+      m != static_cast<int>(BankMode::Harmonic)) {
+    luaL_error(L, "Invalid bank mode %d", m);
+  }
+  return static_cast<BankMode>(m);
+}
+
+int bank_freq(lua_State *L) {
+  LuaNodeHandle *handle;
+  auto *bank = checkBank(L, &handle);
+  commitIf(L, handle->ctx,
+           setScalarOrControl(L, handle, bank->freq, 2, true));
+  lua_settop(L, 1);
+  return 1;
+}
+
+int bank_amp(lua_State *L) {
+  LuaNodeHandle *handle;
+  auto *bank = checkBank(L, &handle);
+  commitIf(L, handle->ctx,
+           setScalarOrControl(L, handle, bank->amp, 2, true));
+  lua_settop(L, 1);
+  return 1;
+}
+
+int bank_count(lua_State *L) {
+  auto *bank = checkBank(L);
+  int n = static_cast<int>(luaL_checkinteger(L, 2));
+  if (n < 1 || n > OscillatorBank::MAX_PARTIALS)
+    return luaL_error(L, "bank count must be 1..%d",
+                      OscillatorBank::MAX_PARTIALS);
+  bank->count.store(n, std::memory_order_relaxed);
+  bank->configure();
+  lua_settop(L, 1);
+  return 1;
+}
+
+int bank_spread(lua_State *L) {
+  auto *bank = checkBank(L);
+  bank->spread.store(static_cast<float>(luaL_checknumber(L, 2)),
+                     std::memory_order_relaxed);
+  bank->configure();
+  lua_settop(L, 1);
+  return 1;
+}
+
+int bank_type(lua_State *L) {
+  auto *bank = checkBank(L);
+  bank->type.store(toWaveform(L, 2), std::memory_order_relaxed);
+  lua_settop(L, 1);
+  return 1;
+}
+
+int bank_mode(lua_State *L) {
+  auto *bank = checkBank(L);
+  bank->mode.store(toBankMode(L, 2), std::memory_order_relaxed);
+  bank->configure();
+  lua_settop(L, 1);
+  return 1;
+}
+
+const luaL_Reg bankMethods[] = {{"freq", bank_freq},   {"amp", bank_amp},
+                                {"count", bank_count}, {"spread", bank_spread},
+                                {"type", bank_type},   {"mode", bank_mode},
+                                {nullptr, nullptr}};
+
+int bank_newindex(lua_State *L) {
+  checkNodeHandle(L, 1, BANK_MT);
+  const char *field = luaL_checkstring(L, 2);
+  for (const luaL_Reg *m = bankMethods; m->name; m++) {
+    if (std::strcmp(field, m->name) == 0) {
+      lua_pushvalue(L, 1);
+      lua_pushvalue(L, 3);
+      lua_replace(L, 2);
+      return m->func(L);
+    }
+  }
+  return luaL_error(L, "unknown bank field '%s'", field);
+}
+
+void createBankMetatable(lua_State *L) {
+  if (luaL_newmetatable(L, BANK_MT)) {
+    lua_newtable(L);
+    luaL_setfuncs(L, bankMethods, 0);
+    pushIndexMethod(L);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, bank_newindex);
+    lua_setfield(L, -2, "__newindex");
+  }
+  lua_pop(L, 1);
+}
+
 // --- Sound builder methods --------------------------------------------------
 
-Oscillator *resolveBuilderOsc(lua_State *L, LuaSoundBuilder *builder) {
-  Graph &graph = getGraphOrThrow(L, builder->ctx);
-  return getNodeAs<Oscillator>(L, graph, builder->sourceId, "oscillator");
+SourceNode *resolveBuilderSource(lua_State *L, LuaSoundBuilder *builder) {
+  return resolve<SourceNode>(L, builder->ctx, builder->source, "source");
 }
 
 Node *resolveBuilderTip(lua_State *L, LuaSoundBuilder *builder) {
-  Graph &graph = getGraphOrThrow(L, builder->ctx);
-  auto &nodes = graph.getNodes();
-  if (builder->currentId < 0 ||
-      builder->currentId >= static_cast<int>(nodes.size()) ||
-      nodes[builder->currentId] == nullptr) {
-    luaL_error(L, "Builder has invalid node");
-  }
-  return nodes[builder->currentId].get();
+  return resolve<Node>(L, builder->ctx, builder->current, "builder node");
+}
+
+void applyStrip(const LuaSoundBuilder *builder, Node *tip) {
+  tip->strip.set(builder->gain, builder->pan);
+  tip->strip.mute.store(builder->mute);
+  tip->strip.solo.store(builder->solo);
 }
 
 int builder_freq(lua_State *L) {
   auto *builder = checkBuilder(L, 1);
-  auto *osc = resolveBuilderOsc(L, builder);
-  LuaNodeHandle fakeHandle{builder->ctx, builder->sourceId};
-  setScalarOrControl(L, &fakeHandle, osc->freq, 2, true);
+  auto *osc = resolveBuilderSource(L, builder);
+  LuaNodeHandle fakeHandle{builder->ctx, builder->source};
+  commitIf(L, fakeHandle.ctx,
+           setScalarOrControl(L, &fakeHandle, osc->freq, 2, true));
   lua_settop(L, 1);
   return 1;
 }
 
 int builder_amp(lua_State *L) {
   auto *builder = checkBuilder(L, 1);
-  auto *osc = resolveBuilderOsc(L, builder);
-  LuaNodeHandle fakeHandle{builder->ctx, builder->sourceId};
-  setScalarOrControl(L, &fakeHandle, osc->amp, 2, true);
+  auto *osc = resolveBuilderSource(L, builder);
+  LuaNodeHandle fakeHandle{builder->ctx, builder->source};
+  commitIf(L, fakeHandle.ctx,
+           setScalarOrControl(L, &fakeHandle, osc->amp, 2, true));
   lua_settop(L, 1);
   return 1;
 }
@@ -438,79 +689,156 @@ int builder_effect(lua_State *L) {
   auto *builder = checkBuilder(L, 1);
   auto *effectHandle = checkNodeHandle(L, 2, FILTER_MT);
   Graph &graph = getGraphOrThrow(L, builder->ctx);
-  auto *effect = getNodeAs<EffectNode>(L, graph, effectHandle->nodeId, "effect");
+  auto *effect =
+      resolve<EffectNode>(L, builder->ctx, effectHandle->ref, "effect");
   Node *upstream = resolveBuilderTip(L, builder);
-  effect->addInput(&upstream->out);
-  graph.addEdge(builder->currentId, effectHandle->nodeId);
-  builder->currentId = effectHandle->nodeId;
+  if (!graph.hasEdge(builder->current.id, effectHandle->ref.id) &&
+      !graph.addEdge(builder->current.id, effectHandle->ref.id))
+    return luaL_error(L, "Cannot add effect: connection would create a cycle");
+  effect->addInput(upstream);
+  graph.commit(); // republish so the plan picks up the new input
+  builder->current = effectHandle->ref;
+
+  // bus settings made so far follow the tip, which is what gets played
+  applyStrip(builder, effect);
   lua_settop(L, 1);
   return 1;
 }
 
 int builder_cutoff(lua_State *L) {
   auto *builder = checkBuilder(L, 1);
-  Graph &graph = getGraphOrThrow(L, builder->ctx);
-  auto *filter = getNodeAs<Filter>(L, graph, builder->currentId, "filter");
-  LuaNodeHandle fakeHandle{builder->ctx, builder->currentId};
-  setScalarOrControl(L, &fakeHandle, filter->cutoff, 2, true);
+  auto *filter = resolve<Filter>(L, builder->ctx, builder->current, "filter");
+  LuaNodeHandle fakeHandle{builder->ctx, builder->current};
+  commitIf(L, fakeHandle.ctx,
+           setScalarOrControl(L, &fakeHandle, filter->cutoff, 2, true));
+  lua_settop(L, 1);
+  return 1;
+}
+
+// gain(g) / pan(p): level and placement of the chain on the master bus,
+// pan from -1 (left) to 1 (right). Take effect at once, also once playing.
+int builder_gain(lua_State *L) {
+  auto *builder = checkBuilder(L, 1);
+  Node *tip = resolveBuilderTip(L, builder);
+  float gain = static_cast<float>(luaL_checknumber(L, 2));
+  if (gain < 0.0f)
+    return luaL_error(L, "gain must not be negative");
+  builder->gain = gain;
+  applyStrip(builder, tip);
   lua_settop(L, 1);
   return 1;
 }
 
+int builder_pan(lua_State *L) {
+  auto *builder = checkBuilder(L, 1);
+  Node *tip = resolveBuilderTip(L, builder);
+  builder->pan = static_cast<float>(luaL_checknumber(L, 2));
+  applyStrip(builder, tip);
+  lua_settop(L, 1);
+  return 1;
+}
+
+// mute([on]) / solo([on]): while any playing chain is soloed, only soloed
+// chains are heard.
+int builder_mute(lua_State *L) {
+  auto *builder = checkBuilder(L, 1);
+  Node *tip = resolveBuilderTip(L, builder);
+  builder->mute = lua_isnone(L, 2) || lua_toboolean(L, 2);
+  applyStrip(builder, tip);
+  lua_settop(L, 1);
+  return 1;
+}
+
+int builder_solo(lua_State *L) {
+  auto *builder = checkBuilder(L, 1);
+  Node *tip = resolveBuilderTip(L, builder);
+  builder->solo = lua_isnone(L, 2) || lua_toboolean(L, 2);
+  applyStrip(builder, tip);
+  lua_settop(L, 1);
+  return 1;
+}
+
+// play() -> the builder, so a playing chain can be kept for gain and pan
 int builder_play(lua_State *L) {
   auto *builder = checkBuilder(L, 1);
   Graph &graph = getGraphOrThrow(L, builder->ctx);
-  auto &nodes = graph.getNodes();
-  if (builder->currentId < 0 ||
-      builder->currentId >= static_cast<int>(nodes.size()) ||
-      nodes[builder->currentId] == nullptr) {
-    return luaL_error(L, "Cannot play: invalid node");
-  }
-
-  nodes[builder->currentId]->sinked.store(true, std::memory_order_relaxed);
-  auto &sinks = graph.getSinkedNodes();
-  if (std::find(sinks.begin(), sinks.end(), builder->currentId) == sinks.end())
-    sinks.push_back(builder->currentId);
-  graph.sort();
-  return 0;
+  Node *tip = resolveBuilderTip(L, builder);
+  applyStrip(builder, tip);
+  tip->sinked.store(true, std::memory_order_relaxed);
+  graph.addSink(builder->current.id);
+  graph.commit();
+  lua_settop(L, 1);
+  return 1;
 }
 
 const luaL_Reg builderMethods[] = {{"freq", builder_freq},
                                    {"amp", builder_amp},
                                    {"effect", builder_effect},
                                    {"cutoff", builder_cutoff},
+                                   {"gain", builder_gain},
+                                   {"pan", builder_pan},
+                                   {"mute", builder_mute},
+                                   {"solo", builder_solo},
                                    {"play", builder_play},
                                    {nullptr, nullptr}};
 
-int builder_index(lua_State *L) { return push_method_closure(L, BUILDER_MT); }
-
 void createBuilderMetatable(lua_State *L) {
   if (luaL_newmetatable(L, BUILDER_MT)) {
     lua_newtable(L);
     luaL_setfuncs(L, builderMethods, 0);
-    lua_setfield(L, -2, "__methods");
-    lua_pushcfunction(L, builder_index);
+    pushIndexMethod(L);
     lua_setfield(L, -2, "__index");
   }
   lua_pop(L, 1);
 }
 
+// --- Wavetables -------------------------------------------------------------
+
+void createWavetableMetatable(lua_State *L) {
+  luaL_newmetatable(L, WAVETABLE_MT);
+  lua_pop(L, 1);
+}
+
 // --- Constructors -----------------------------------------------------------
 
+// A node from `make()`, or while a reload runs the previous run's first
+// node of type T still unclaimed, for the caller to set up in place: its
+// phase and filter memory carry on, and the old plan keeps rendering it.
+template <typename T, typename Make>
+T *createNode(LuaContext *ctx, Graph &graph, int &id, Make &&make) {
+  T *node = nullptr;
+  auto it = ctx->reusable.find(typeid(T));
+  if (it != ctx->reusable.end() && !it->second.empty()) {
+    id = it->second.front();
+    it->second.pop_front();
+    node = static_cast<T *>(graph.getNodes()[id].get());
+  } else {
+    std::unique_ptr<T> made = make();
+    node = made.get();
+    id = graph.addNode(std::move(made));
+  }
+  ctx->created.push_back(id);
+  return node;
+}
+
 int lua_create_osc(lua_State *L) {
   auto *ctx = getCtx(L);
   Graph &graph = getGraphOrThrow(L, ctx);
 
   // Create oscillator with default parameters first
-  auto node = Oscillator::init(1.0f, 440.0f, toWaveform(L, 3));
-  int id = graph.addNode(std::move(node));
-  auto *handle = pushNodeHandle(L, ctx, id, OSC_MT);
+  int id;
+  auto *osc = createNode<Oscillator>(
+      ctx, graph, id, [] { return Oscillator::init(1.0f, 440.0f); });
+  osc->interp.store(Interpolation::Linear, std::memory_order_relaxed);
+  auto *handle =
+      pushNodeHandle(L, ctx, makeRef(graph, id, NodeTag::Oscillator), OSC_MT);
 
-  auto *osc = getNodeAs<Oscillator>(L, graph, id, "oscillator");
+  setOscShape(L, osc, 3); // type (arg 3)
 
   // Set each parameter, handling both control nodes and numeric values
-  setScalarOrControl(L, handle, osc->amp, 1, true);  // amp (arg 1)
-  setScalarOrControl(L, handle, osc->freq, 2, true); // freq (arg 2)
+  bool attached = setScalarOrControl(L, handle, osc->amp, 1, true); // amp
+  attached |= setScalarOrControl(L, handle, osc->freq, 2, true);    // freq
+  commitIf(L, ctx, attached);
 
   return 1;
 }
@@ -520,17 +848,58 @@ int lua_create_lfo(lua_State *L) {
   Graph &graph = getGraphOrThrow(L, ctx);
 
   // Create LFO with default parameters first
-  auto node = LFO::init(0.0f, 1.0f, 5.0f, 0.0f, toWaveform(L, 5));
-  int id = graph.addNode(std::move(node));
-  auto *handle = pushNodeHandle(L, ctx, id, LFO_MT);
-
-  auto *lfo = getNodeAs<LFO>(L, graph, id, "lfo");
+  Waveform type = toWaveform(L, 5);
+  int decimation = lua_isnoneornil(L, 6) ? 0 : checkDecimation(L, 6, 0);
+  int id;
+  auto *lfo = createNode<LFO>(ctx, graph, id, [type] {
+    return LFO::init(0.0f, 1.0f, 5.0f, 0.0f, type);
+  });
+  lfo->type.store(type, std::memory_order_relaxed);
+  lfo->decimation.store(decimation);
+  auto *handle =
+      pushNodeHandle(L, ctx, makeRef(graph, id, NodeTag::LFO), LFO_MT);
 
   // Set each parameter, handling both control nodes and numeric values
-  setScalarOrControl(L, handle, lfo->base, 1, true);  // base (arg 1)
-  setScalarOrControl(L, handle, lfo->amp,  2, true);  // amp (arg 2)
-  setScalarOrControl(L, handle, lfo->freq, 3, true);  // freq (arg 3)
-  setScalarOrControl(L, handle, lfo->shift, 4, true); // shift (arg 4)
+  bool attached = setScalarOrControl(L, handle, lfo->base, 1, true); // base
+  attached |= setScalarOrControl(L, handle, lfo->amp, 2, true);      // amp
+  attached |= setScalarOrControl(L, handle, lfo->freq, 3, true);     // freq
+  attached |= setScalarOrControl(L, handle, lfo->shift, 4, true);    // shift
+  commitIf(L, ctx, attached);
+
+  return 1;
+}
+
+int lua_create_bank(lua_State *L) {
+  auto *ctx = getCtx(L);
+  Graph &graph = getGraphOrThrow(L, ctx);
+
+  int count = static_cast<int>(luaL_checkinteger(L, 3));
+  if (count < 1 || count > OscillatorBank::MAX_PARTIALS)
+    return luaL_error(L, "bank count must be 1..%d",
+                      OscillatorBank::MAX_PARTIALS);
+  float spread = static_cast<float>(luaL_checknumber(L, 4));
+  Waveform type = toWaveform(L, 5);
+  BankMode mode = toBankMode(L, 6);
+
+  int id;
+  auto *bank = createNode<OscillatorBank>(ctx, graph, id, [&] {
+    return OscillatorBank::init(1.0f, 110.0f, count, spread, type, mode);
+  });
+  // a reused bank rebuilds its partials only if their layout changed
+  if (bank->count.load() != count || bank->spread.load() != spread ||
+      bank->type.load() != type || bank->mode.load() != mode) {
+    bank->count.store(count, std::memory_order_relaxed);
+    bank->spread.store(spread, std::memory_order_relaxed);
+    bank->type.store(type, std::memory_order_relaxed);
+    bank->mode.store(mode, std::memory_order_relaxed);
+    bank->configure();
+  }
+  auto *handle =
+      pushNodeHandle(L, ctx, makeRef(graph, id, NodeTag::Bank), BANK_MT);
+
+  bool attached = setScalarOrControl(L, handle, bank->amp, 1, true); // amp
+  attached |= setScalarOrControl(L, handle, bank->freq, 2, true);    // freq
+  commitIf(L, ctx, attached);
 
   return 1;
 }
@@ -540,34 +909,387 @@ int lua_create_filter(lua_State *L) {
   Graph &graph = getGraphOrThrow(L, ctx);
 
   // Create filter with default parameters first
-  auto node = Filter::init(1000.0f, 1.0f);
-  int id = graph.addNode(std::move(node));
-  auto *handle = pushNodeHandle(L, ctx, id, FILTER_MT);
-
-  auto *filter = getNodeAs<Filter>(L, graph, id, "filter");
+  int id;
+  auto *filter = createNode<Filter>(
+      ctx, graph, id, [] { return Filter::init(1000.0f, 1.0f); });
+  auto *handle =
+      pushNodeHandle(L, ctx, makeRef(graph, id, NodeTag::Filter), FILTER_MT);
 
   // Set each parameter, handling both control nodes and numeric values
-  setScalarOrControl(L, handle, filter->cutoff, 1, true);  // cutoff (arg 1)
-  setScalarOrControl(L, handle, filter->q, 2, true);       // q (arg 2)
+  bool attached =
+      setScalarOrControl(L, handle, filter->cutoff, 1, true); // cutoff
+  attached |= setScalarOrControl(L, handle, filter->q, 2, true); // q
+  commitIf(L, ctx, attached);
+
+  return 1;
+}
+
+// wavetable({...}) -> band-limited table from one cycle of samples
+int lua_create_wavetable(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  size_t len = lua_rawlen(L, 1);
+  if (len < 2)
+    return luaL_error(L, "wavetable needs at least 2 samples");
+
+  std::vector<float> cycle(len);
+  for (size_t i = 0; i < len; i++) {
+    lua_rawgeti(L, 1, static_cast<lua_Integer>(i + 1));
+    cycle[i] = static_cast<float>(luaL_checknumber(L, -1));
+    lua_pop(L, 1);
+  }
+
+  auto **wt = static_cast<const Wavetable **>(
+      lua_newuserdata(L, sizeof(const Wavetable *)));
+  *wt = Wavetable::fromCycle(cycle);
+  luaL_getmetatable(L, WAVETABLE_MT);
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+// decimation([n]) -> default samples per control tick, after setting it
+int lua_decimation(lua_State *L) {
+  if (!lua_isnoneornil(L, 1))
+    ControlNode::defaultDecimation.store(checkDecimation(L, 1, 1));
+  lua_pushinteger(L, ControlNode::defaultDecimation.load());
+  return 1;
+}
+
+// threads([n]) -> helper render threads in use, after setting them to n
+int lua_threads(lua_State *L) {
+  auto *ctx = getCtx(L);
+  if (!ctx || !ctx->audio)
+    return luaL_error(L, "Audio engine is not available");
+  if (!lua_isnoneornil(L, 1)) {
+    lua_Integer n = luaL_checkinteger(L, 1);
+    if (n < 0 || n > WorkerPool::MAX_WORKERS)
+      return luaL_error(L, "threads must be between 0 and %d",
+                        WorkerPool::MAX_WORKERS);
+    ctx->audio->setThreads(static_cast<int>(n));
+  }
+  lua_pushinteger(L, ctx->audio->getThreads());
+  return 1;
+}
+
+// Name of a node's type as the Lua constructors spell it.
+const char *nodeKind(const Node *node) {
+  if (dynamic_cast<const Oscillator *>(node))
+    return "osc";
+  if (dynamic_cast<const OscillatorBank *>(node))
+    return "bank";
+  if (dynamic_cast<const LFO *>(node))
+    return "lfo";
+  if (dynamic_cast<const Filter *>(node))
+    return "filter";
+  return "node";
+}
+
+void setNumberField(lua_State *L, const char *key, double value) {
+  lua_pushnumber(L, value);
+  lua_setfield(L, -2, key);
+}
+
+// stats() -> { callbacks, xruns, load, peak, mean, histogram }; loads are
+// percentages of the callback deadline, histogram[i] counts callbacks that
+// took (i-1)/8 to i/8 of it.
+int lua_stats(lua_State *L) {
+  auto *ctx = getCtx(L);
+  if (!ctx || !ctx->audio)
+    return luaL_error(L, "Audio engine is not available");
+  CallbackStats::Snapshot s = ctx->audio->callbackStats().read();
+
+  lua_createtable(L, 0, 6);
+  setNumberField(L, "callbacks", static_cast<double>(s.callbacks));
+  setNumberField(L, "xruns", static_cast<double>(s.xruns));
+  setNumberField(L, "load", s.lastLoad * 100.0);
+  setNumberField(L, "peak", s.peakLoad * 100.0);
+  setNumberField(L, "mean", s.meanLoad * 100.0);
+  lua_createtable(L, CallbackStats::HISTOGRAM_BINS, 0);
+  for (int i = 0; i < CallbackStats::HISTOGRAM_BINS; i++) {
+    lua_pushnumber(L, static_cast<double>(s.histogram[i]));
+    lua_rawseti(L, -2, i + 1);
+  }
+  lua_setfield(L, -2, "histogram");
+  return 1;
+}
+
+int lua_stats_call(lua_State *L) {
+  lua_remove(L, 1); // the stats table itself
+  return lua_stats(L);
+}
+
+// stats.reset(): restart the callback counters and peak.
+int lua_stats_reset(lua_State *L) {
+  auto *ctx = getCtx(L);
+  if (!ctx || !ctx->audio)
+    return luaL_error(L, "Audio engine is not available");
+  ctx->audio->callbackStats().reset();
+  return 0;
+}
+
+// stats.timing([on]) -> whether per-node timing is on, after setting it
+int lua_stats_timing(lua_State *L) {
+  if (!lua_isnoneornil(L, 1))
+    RenderPlan::timing.store(lua_toboolean(L, 1));
+  lua_pushboolean(L, RenderPlan::timing.load());
+  return 1;
+}
 
+// stats.nodes() -> { { id, kind, ns, load }, ... } for every active node,
+// most expensive first: ns per frame and percent of one core in real time.
+// Needs stats.timing(true).
+int lua_stats_nodes(lua_State *L) {
+  auto *ctx = getCtx(L);
+  Graph &graph = getGraphOrThrow(L, ctx);
+
+  struct Entry {
+    int id;
+    const Node *node;
+    float cost;
+  };
+  std::vector<Entry> entries;
+  auto &nodes = graph.getNodes();
+  for (int id = 0; id < static_cast<int>(nodes.size()); id++) {
+    const Node *node = nodes[id].get();
+    if (node && node->active.load(std::memory_order_relaxed))
+      entries.push_back(
+          {id, node, node->cost.load(std::memory_order_relaxed)});
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry &a, const Entry &b) { return a.cost > b.cost; });
+
+  lua_createtable(L, static_cast<int>(entries.size()), 0);
+  for (size_t i = 0; i < entries.size(); i++) {
+    const Entry &e = entries[i];
+    lua_createtable(L, 0, 4);
+    lua_pushinteger(L, e.id);
+    lua_setfield(L, -2, "id");
+    lua_pushstring(L, nodeKind(e.node));
+    lua_setfield(L, -2, "kind");
+    setNumberField(L, "ns", e.cost);
+    setNumberField(L, "load", e.cost * SampleRate::get().hz * 1e-7);
+    lua_rawseti(L, -2, static_cast<lua_Integer>(i + 1));
+  }
+  return 1;
+}
+
+void registerStats(lua_State *L, LuaContext *ctx) {
+  const luaL_Reg functions[] = {{"reset", lua_stats_reset},
+                                {"timing", lua_stats_timing},
+                                {"nodes", lua_stats_nodes},
+                                {nullptr, nullptr}};
+  lua_newtable(L);
+  lua_pushlightuserdata(L, ctx);
+  luaL_setfuncs(L, functions, 1);
+
+  lua_newtable(L); // metatable: stats() itself reads the callback counters
+  lua_pushlightuserdata(L, ctx);
+  lua_pushcclosure(L, lua_stats_call, 1);
+  lua_setfield(L, -2, "__call");
+  lua_setmetatable(L, -2);
+
+  lua_setglobal(L, "stats");
+}
+
+// Optional non-negative integer field of the table at `index`; 0 if absent.
+uint32_t checkConfigField(lua_State *L, int index, const char *key) {
+  lua_getfield(L, index, key);
+  lua_Integer v = lua_isnil(L, -1) ? 0 : luaL_checkinteger(L, -1);
+  lua_pop(L, 1);
+  if (v < 0)
+    luaL_error(L, "%s must not be negative", key);
+  return static_cast<uint32_t>(v);
+}
+
+// audio([{ rate = HZ, period = FRAMES, periods = N }]) -> the settings in
+// use, after reopening the device with the given ones. Omitted fields go
+// back to the device's choice.
+int lua_audio(lua_State *L) {
+  auto *ctx = getCtx(L);
+  if (!ctx || !ctx->audio)
+    return luaL_error(L, "Audio engine is not available");
+  if (!lua_isnoneornil(L, 1)) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    AudioConfig request;
+    request.sampleRate = checkConfigField(L, 1, "rate");
+    request.periodFrames = checkConfigField(L, 1, "period");
+    request.periods = checkConfigField(L, 1, "periods");
+    if (!ctx->audio->configure(request))
+      return luaL_error(L, "Could not open the audio device");
+  }
+
+  const AudioConfig &config = ctx->audio->getConfig();
+  lua_createtable(L, 0, 3);
+  lua_pushinteger(L, config.sampleRate);
+  lua_setfield(L, -2, "rate");
+  lua_pushinteger(L, config.periodFrames);
+  lua_setfield(L, -2, "period");
+  lua_pushinteger(L, config.periods);
+  lua_setfield(L, -2, "periods");
+  return 1;
+}
+
+Sequencer &getSequencerOrThrow(lua_State *L, LuaContext *ctx) {
+  if (!ctx || !ctx->sequencer)
+    luaL_error(L, "Sequencer is not available");
+  return *ctx->sequencer;
+}
+
+// tempo([bpm]) -> beats per minute, after setting it
+int lua_tempo(lua_State *L) {
+  Sequencer &sequencer = getSequencerOrThrow(L, getCtx(L));
+  if (!lua_isnoneornil(L, 1)) {
+    double bpm = luaL_checknumber(L, 1);
+    if (!(bpm > 0.0))
+      return luaL_error(L, "tempo must be positive");
+    sequencer.setTempo(bpm);
+  }
+  lua_pushnumber(L, sequencer.getTempo());
+  return 1;
+}
+
+// lookahead([beats]) -> how far ahead of playback steps are scheduled
+int lua_lookahead(lua_State *L) {
+  Sequencer &sequencer = getSequencerOrThrow(L, getCtx(L));
+  if (!lua_isnoneornil(L, 1)) {
+    double beats = luaL_checknumber(L, 1);
+    if (!(beats > 0.0))
+      return luaL_error(L, "lookahead must be positive");
+    sequencer.setLookahead(beats);
+  }
+  lua_pushnumber(L, sequencer.getLookahead());
   return 1;
 }
 
+// Parameter `name` of the node handle at `index`.
+ModParam &checkParam(lua_State *L, LuaContext *ctx, int index,
+                     const char *name) {
+  const char *nodeTypes[] = {OSC_MT, LFO_MT, FILTER_MT, BANK_MT};
+  LuaNodeHandle *handle = nullptr;
+  for (const char *mt : nodeTypes)
+    if (!handle)
+      handle = static_cast<LuaNodeHandle *>(luaL_testudata(L, index, mt));
+  if (!handle)
+    luaL_typeerror(L, index, "node");
+
+  ModParam *param = nullptr;
+  switch (handle->ref.tag) {
+  case NodeTag::Oscillator:
+  case NodeTag::Bank: {
+    auto *source = resolve<SourceNode>(L, ctx, handle->ref, "source");
+    if (std::strcmp(name, "freq") == 0)
+      param = &source->freq;
+    else if (std::strcmp(name, "amp") == 0)
+      param = &source->amp;
+    break;
+  }
+  case NodeTag::LFO: {
+    auto *lfo = resolve<LFO>(L, ctx, handle->ref, "lfo");
+    if (std::strcmp(name, "base") == 0)
+      param = &lfo->base;
+    else if (std::strcmp(name, "amp") == 0)
+      param = &lfo->amp;
+    else if (std::strcmp(name, "freq") == 0)
+      param = &lfo->freq;
+    else if (std::strcmp(name, "shift") == 0)
+      param = &lfo->shift;
+    break;
+  }
+  case NodeTag::Filter: {
+    auto *filter = resolve<Filter>(L, ctx, handle->ref, "filter");
+    if (std::strcmp(name, "cutoff") == 0)
+      param = &filter->cutoff;
+    else if (std::strcmp(name, "q") == 0)
+      param = &filter->q;
+    break;
+  }
+  }
+  if (!param)
+    luaL_error(L, "node has no parameter '%s'", name);
+  return *param;
+}
+
+// seq(node, param, steps [, division]): loop `steps` into the node's
+// parameter, one step every `division` beats (1/4 by default, sixteenths
+// in 4/4). A step is a number, or false for a rest. A parameter driven by
+// a controller is refused: steps would not be heard over it.
+int lua_seq(lua_State *L) {
+  auto *ctx = getCtx(L);
+  Sequencer &sequencer = getSequencerOrThrow(L, ctx);
+  const char *name = luaL_checkstring(L, 2);
+  ModParam &param = checkParam(L, ctx, 1, name);
+  if (getGraphOrThrow(L, ctx).source(param))
+    return luaL_error(L, "'%s' is driven by a controller; sequence the "
+                         "controller's base instead", name);
+  luaL_checktype(L, 3, LUA_TTABLE);
+  double division = luaL_optnumber(L, 4, 0.25);
+  if (!(division > 0.0))
+    return luaL_error(L, "division must be positive");
+
+  Pattern pattern;
+  lua_Integer count = static_cast<lua_Integer>(lua_rawlen(L, 3));
+  for (lua_Integer i = 1; i <= count; i++) {
+    lua_rawgeti(L, 3, i);
+    if (lua_isnumber(L, -1))
+      pattern.steps.push_back(
+          {(i - 1) * division, static_cast<float>(lua_tonumber(L, -1))});
+    else if (lua_toboolean(L, -1))
+      return luaL_error(L, "step %d is neither a number nor false",
+                        static_cast<int>(i));
+    lua_pop(L, 1);
+  }
+  pattern.length = count * division;
+  sequencer.addTrack(&param, std::move(pattern));
+  return 0;
+}
+
 int lua_sound_builder(lua_State *L) {
   auto *ctx = getCtx(L);
-  auto *sourceHandle = checkNodeHandle(L, 1, OSC_MT);
-  pushBuilder(L, ctx, sourceHandle->nodeId);
+  auto *sourceHandle =
+      static_cast<LuaNodeHandle *>(luaL_testudata(L, 1, BANK_MT));
+  if (!sourceHandle)
+    sourceHandle = checkNodeHandle(L, 1, OSC_MT);
+  pushBuilder(L, ctx, sourceHandle->ref);
   return 1;
 }
 
 } // namespace
 
+std::unordered_map<std::string, int> namedNodes(lua_State *L) {
+  const char *nodeTypes[] = {OSC_MT, LFO_MT, FILTER_MT, BANK_MT};
+  std::unordered_map<std::string, int> named;
+  lua_pushglobaltable(L);
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    if (lua_type(L, -2) == LUA_TSTRING && lua_isuserdata(L, -1)) {
+      for (const char *mt : nodeTypes) {
+        auto *handle =
+            static_cast<LuaNodeHandle *>(luaL_testudata(L, -1, mt));
+        if (!handle)
+          continue;
+        // skip handles to nodes removed since
+        const NodeRef &ref = handle->ref;
+        Graph *graph = handle->ctx ? handle->ctx->graph : nullptr;
+        if (graph && ref.id < static_cast<int>(graph->getNodes().size()) &&
+            graph->getNodes()[ref.id] &&
+            graph->generation(ref.id) == ref.generation)
+          named[lua_tostring(L, -2)] = ref.id;
+        break;
+      }
+    }
+    lua_pop(L, 1); // keep the key for lua_next
+  }
+  lua_pop(L, 1);
+  return named;
+}
+
 void registerLuaBindings(lua_State *L, LuaContext *ctx) {
   registerWaveformGlobals(L);
   createOscMetatable(L);
   createLfoMetatable(L);
   createFilterMetatable(L);
+  createBankMetatable(L);
   createBuilderMetatable(L);
+  createWavetableMetatable(L);
 
   lua_pushlightuserdata(L, ctx);
   lua_pushcclosure(L, lua_create_osc, 1);
@@ -581,7 +1303,39 @@ void registerLuaBindings(lua_State *L, LuaContext *ctx) {
   lua_pushcclosure(L, lua_create_filter, 1);
   lua_setglobal(L, "filter");
 
+  lua_pushlightuserdata(L, ctx);
+  lua_pushcclosure(L, lua_create_bank, 1);
+  lua_setglobal(L, "bank");
+
   lua_pushlightuserdata(L, ctx);
   lua_pushcclosure(L, lua_sound_builder, 1);
   lua_setglobal(L, "sound");
+
+  lua_pushlightuserdata(L, ctx);
+  lua_pushcclosure(L, lua_threads, 1);
+  lua_setglobal(L, "threads");
+
+  lua_pushcfunction(L, lua_decimation);
+  lua_setglobal(L, "decimation");
+
+  registerStats(L, ctx);
+
+  lua_pushlightuserdata(L, ctx);
+  lua_pushcclosure(L, lua_audio, 1);
+  lua_setglobal(L, "audio");
+
+  lua_pushcfunction(L, lua_create_wavetable);
+  lua_setglobal(L, "wavetable");
+
+  lua_pushlightuserdata(L, ctx);
+  lua_pushcclosure(L, lua_tempo, 1);
+  lua_setglobal(L, "tempo");
+
+  lua_pushlightuserdata(L, ctx);
+  lua_pushcclosure(L, lua_lookahead, 1);
+  lua_setglobal(L, "lookahead");
+
+  lua_pushlightuserdata(L, ctx);
+  lua_pushcclosure(L, lua_seq, 1);
+  lua_setglobal(L, "seq");
 }
@@ -1,23 +1,103 @@
 #include "lua_engine.h"
 
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "linenoise.h"
 
-LuaEngine::LuaEngine(Graph &graph, AudioEngine &ae, PatternEngine &pe)
-    : graph(graph), ae(ae), pe(pe) {
-  L = luaL_newstate();
-  luaL_openlibs(L);
+namespace {
+
+// Where the reloaded patch binds a global name to another node than the
+// running one did, the node now named carries on from the one that was:
+// a node reused in creation order is set up again in place, but its phase
+// belongs to the name. Handoffs are listed so each node is read before it
+// adopts another's state; names swapped in a cycle keep their nodes as
+// they are.
+size_t handOffNamed(Graph &graph,
+                    const std::unordered_map<std::string, int> &previousNames,
+                    const std::unordered_map<std::string, int> &nextNames) {
+  auto &nodes = graph.getNodes();
+  auto live = [&nodes](int id) {
+    return id >= 0 && id < static_cast<int>(nodes.size()) && nodes[id];
+  };
+
+  std::unordered_map<int, int> from; // node -> node it carries on from
+  std::unordered_set<int> read;
+  for (const auto &[name, id] : nextNames) {
+    auto it = previousNames.find(name);
+    if (it == previousNames.end() || it->second == id || !live(id) ||
+        !live(it->second) || from.count(id) || read.count(it->second) ||
+        typeid(*nodes[id]) != typeid(*nodes[it->second]))
+      continue;
+    from[id] = it->second;
+    read.insert(it->second);
+  }
+
+  size_t count = 0;
+  for (const auto &link : from) {
+    if (read.count(link.first))
+      continue; // not the end of a chain
+    for (auto it = from.find(link.first); it != from.end();
+         it = from.find(it->second)) {
+      graph.handOff(it->second, it->first);
+      count++;
+    }
+  }
+  return count;
+}
 
+// Files behind the modules `require` has loaded into `L`.
+std::vector<std::filesystem::path> requiredFiles(lua_State *L) {
+  std::vector<std::filesystem::path> files;
+  lua_getglobal(L, "package");
+  if (!lua_istable(L, -1)) {
+    lua_pop(L, 1);
+    return files;
+  }
+  lua_getfield(L, -1, "loaded");
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    lua_pop(L, 1); // value; keep the module name
+    if (lua_type(L, -1) != LUA_TSTRING)
+      continue;
+    // package.searchpath(name, package.path); nil for built-in libraries
+    lua_getfield(L, -3, "searchpath");
+    lua_pushvalue(L, -2);
+    lua_getfield(L, -5, "path");
+    if (lua_pcall(L, 2, 1, 0) == 0 && lua_type(L, -1) == LUA_TSTRING)
+      files.emplace_back(lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 2);
+  return files;
+}
+
+const std::filesystem::path RUNTIME_PATH = "lua/runtime.lua";
+
+} // namespace
+
+LuaEngine::LuaEngine(Graph &graph, AudioEngine &ae, PatternEngine &pe,
+                     Sequencer &sequencer)
+    : graph(graph), ae(ae), pe(pe), sequencer(sequencer) {
   ctx.graph = &graph;
   ctx.audio = &ae;
+  ctx.sequencer = &sequencer;
+  openState();
+}
+
+void LuaEngine::openState() {
+  L = luaL_newstate();
+  luaL_openlibs(L);
   registerLuaBindings(L, &ctx);
 
-  const std::filesystem::path runtimePath = "lua/runtime.lua";
-  if (std::filesystem::exists(runtimePath)) {
-    if (luaL_loadfile(L, runtimePath.c_str()) || lua_pcall(L, 0, 0, 0)) {
+  if (std::filesystem::exists(RUNTIME_PATH)) {
+    if (luaL_loadfile(L, RUNTIME_PATH.c_str()) || lua_pcall(L, 0, 0, 0)) {
       std::cerr << "Lua runtime error: " << lua_tostring(L, -1) << std::endl;
       lua_pop(L, 1);
     }
@@ -31,17 +111,20 @@ LuaEngine::~LuaEngine() {
 }
 
 void LuaEngine::bindFunction(const std::string &name, lua_CFunction fn) {
+  std::lock_guard<std::mutex> lock(luaMutex);
   lua_register(L, name.c_str(), fn);
 }
 
 void LuaEngine::runString(const std::string &code) {
+  std::lock_guard<std::mutex> lock(luaMutex);
   if (luaL_loadstring(L, code.c_str()) || lua_pcall(L, 0, 0, 0)) {
     std::cerr << "Lua error: " << lua_tostring(L, -1) << std::endl;
     lua_pop(L, 1);
   }
 }
 
-void LuaEngine::runFile(const std::filesystem::path &path) {
+void LuaEngine::runFile(const std::filesystem::path &path, bool watch) {
+  std::lock_guard<std::mutex> lock(luaMutex);
   std::ifstream in(path);
   if (in) {
     std::cout << "--- " << path << " ---\n";
@@ -53,78 +136,113 @@ void LuaEngine::runFile(const std::filesystem::path &path) {
     lua_pop(L, 1);
   }
 
-  startWatcher(path);
+  if (!watch)
+    return;
+  if (std::find(patches.begin(), patches.end(), path) == patches.end())
+    patches.push_back(path);
+  updateWatcher();
 }
 
-void LuaEngine::reloadFile(const std::filesystem::path &path) {
-  // Store the audio engine reference
-  AudioEngine *ae_ptr = ctx.audio;
-
-  // Clear all nodes from the graph to destroy all audio objects
-  auto &nodes = graph.getNodes();
-  for (size_t i = 0; i < nodes.size(); i++) {
-    if (nodes[i]) {
-      graph.removeNode(i);
-    }
-  }
-
-  // Also clear the sinked nodes
-  graph.getSinkedNodes().clear();
+void LuaEngine::reload() {
+  std::lock_guard<std::mutex> lock(luaMutex);
 
-  // Clean up the current Lua state
+  // identities in the running patch, to match against the new one
+  std::unordered_map<std::string, int> previousNames = namedNodes(L);
+  std::vector<int> previous = std::move(ctx.created);
+  ctx.created.clear();
   lua_close(L);
+  // the old patterns keep playing into the old nodes until the swap
+  const size_t staleTracks = sequencer.trackCount();
 
-  // Create a fresh Lua state
-  L = luaL_newstate();
-  luaL_openlibs(L);
-
-  // Re-initialize the context (graph is already cleared)
-  ctx.graph = &graph; // Use the same graph reference but now it's empty
-  ctx.audio = ae_ptr;
-  registerLuaBindings(L, &ctx);
+  // Run the new patch against the old one, which keeps playing: nothing
+  // is published until endEdit() swaps in one plan. Constructors take the
+  // old nodes over by type in creation order (LuaContext::reusable) and
+  // set them up in place. The edges and sinks among those are cleared for
+  // the run to make again; links it does not remake are dropped after.
+  graph.beginEdit();
+  auto &nodes = graph.getNodes();
+  std::vector<char> old(nodes.size(), 0);
+  for (int id : previous) {
+    if (id >= static_cast<int>(nodes.size()) || !nodes[id])
+      continue;
+    old[id] = 1;
+    ctx.reusable[typeid(*nodes[id])].push_back(id);
+  }
+  std::vector<std::pair<int, int>> edges;
+  for (int id : previous) {
+    if (!old[id])
+      continue;
+    for (int child : graph.getChildren(id))
+      if (old[child])
+        edges.push_back({id, child});
+  }
+  for (const auto &[parent, child] : edges)
+    graph.removeEdge(parent, child);
+  std::vector<int> sinks;
+  for (int id : graph.getSinkedNodes())
+    if (old[id])
+      sinks.push_back(id);
+  for (int id : sinks)
+    graph.removeSink(id);
 
-  // Load the runtime file
-  const std::filesystem::path runtimePath = "lua/runtime.lua";
-  if (std::filesystem::exists(runtimePath)) {
-    if (luaL_loadfile(L, runtimePath.c_str()) || lua_pcall(L, 0, 0, 0)) {
-      std::cerr << "Lua runtime error: " << lua_tostring(L, -1) << std::endl;
+  openState();
+  for (const std::filesystem::path &path : patches) {
+    std::cout << "--- reloading " << path << " ---\n";
+    if (luaL_loadfile(L, path.c_str()) || lua_pcall(L, 0, 0, 0)) {
+      std::cerr << "Lua error: " << lua_tostring(L, -1) << std::endl;
       lua_pop(L, 1);
     }
   }
+  ctx.reusable.clear(); // nodes made from the prompt on are new
 
-  // Now load and run the target file
-  std::ifstream in(path);
-  if (in) {
-    std::cout << "--- reloading " << path << " ---\n";
-  }
-  if (luaL_loadfile(L, path.c_str()) || lua_pcall(L, 0, 0, 0)) {
-    std::cerr << "Lua error: " << lua_tostring(L, -1) << std::endl;
-    lua_pop(L, 1);
-  }
-}
+  for (const auto &[parent, child] : edges)
+    if (!graph.hasEdge(parent, child))
+      graph.unlink(parent, child);
+  const std::vector<int> &played = graph.getSinkedNodes();
+  for (int id : sinks)
+    if (std::find(played.begin(), played.end(), id) == played.end())
+      nodes[id]->sinked.store(false, std::memory_order_relaxed);
+  size_t moved = handOffNamed(graph, previousNames, namedNodes(L));
 
-void LuaEngine::startWatcher(const std::filesystem::path &path) {
-  watchingFile.store(true);
-  watchThread = std::thread([this, path] {
-    auto last = std::filesystem::last_write_time(path);
-    while (watchingFile.load(std::memory_order_relaxed)) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(200));
-      auto now = std::filesystem::last_write_time(path);
-      if (now != last) {
-        last = now;
-        reloadFile(path); // signal main thread
-      }
+  std::vector<char> kept(nodes.size(), 0);
+  for (int id : ctx.created)
+    kept[id] = 1;
+  size_t reused = 0, removed = 0;
+  for (int id : previous) {
+    if (!old[id])
+      continue;
+    if (kept[id]) {
+      reused++;
+      continue;
     }
-  });
+    graph.removeNode(id);
+    removed++;
+  }
+  graph.endEdit();
+  // the new patch brings its own patterns; the old ones point into nodes
+  // now gone
+  sequencer.dropTracks(staleTracks);
+  std::cout << "reload: kept " << reused << " nodes (" << moved
+            << " following their name), added "
+            << ctx.created.size() - reused << ", removed " << removed
+            << std::endl;
+
+  updateWatcher(); // the new run may require different modules
 }
 
-void LuaEngine::stopWatcher() {
-  if (!watchingFile.exchange(false))
-    return;
-  if (watchThread.joinable())
-    watchThread.join();
+void LuaEngine::updateWatcher() {
+  std::vector<std::filesystem::path> files = patches;
+  files.push_back(RUNTIME_PATH);
+  for (std::filesystem::path &module : requiredFiles(L))
+    files.push_back(std::move(module));
+
+  if (!watcher)
+    watcher = std::make_unique<FileWatcher>([this] { reload(); });
+  watcher->setFiles(files);
 }
 
+void LuaEngine::stopWatcher() { watcher.reset(); }
+
 void LuaEngine::loop() {
   char *line;
   while (true) {
@@ -132,9 +250,13 @@ void LuaEngine::loop() {
     if (!line)
       break;
 
-    if (luaL_loadstring(L, line) || lua_pcall(L, 0, LUA_MULTRET, 0)) {
-      printf("Error: %s\n", lua_tostring(L, -1));
-      lua_pop(L, 1);
+    {
+      // a reload from the watcher must not swap the state mid-line
+      std::lock_guard<std::mutex> lock(luaMutex);
+      if (luaL_loadstring(L, line) || lua_pcall(L, 0, LUA_MULTRET, 0)) {
+        printf("Error: %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+      }
     }
 
     linenoiseHistoryAdd(line);
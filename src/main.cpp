@@ -3,15 +3,108 @@
 #include "lua_engine.h"
 #include "nodes.h"
 #include "pattern.h"
+#include "render.h"
+#include "sequencer.h"
+#include "voice.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+namespace {
+
+// Prebuilt voices per registered voice template.
+constexpr int VOICES_PER_TEMPLATE = 16;
+
+int usage(const char *argv0) {
+  std::cerr << "usage: " << argv0 << " [options] [patch.lua]\n"
+            << "       " << argv0
+            << " --render patch.lua --seconds N [--out file.wav] [options]\n"
+            << "options: --threads N  --rate HZ  --period FRAMES  --periods N"
+            << std::endl;
+  return 1;
+}
+
+// Headless bounce: evaluate the patch without opening a device.
+int runOffline(const std::string &patch, double seconds,
+               const std::string &outPath, int threads,
+               const AudioConfig &config) {
+  Graph graph;
+  VoiceManager voices(graph, VOICES_PER_TEMPLATE);
+  PatternEngine pEngine;
+  pEngine.setHandler(&voices);
+  AudioEngine aEngine(graph, false, config);
+  aEngine.setPatternEngine(&pEngine);
+  aEngine.setVoiceManager(&voices); // no deadline offline: limit stays put
+  aEngine.setThreads(threads);
+  Sequencer sequencer(aEngine, pEngine); // pumped by the render loop
+  LuaEngine lEngine(graph, aEngine, pEngine, sequencer);
+  lEngine.runFile(patch, false);
+
+  RenderStats stats;
+  if (!renderOffline(aEngine, seconds, outPath, stats, &sequencer))
+    return 1;
+
+  std::cout << "rendered " << stats.audioSeconds << " s in "
+            << stats.renderSeconds << " s (" << stats.realtimeFactor()
+            << "x real time)";
+  if (!outPath.empty())
+    std::cout << " -> " << outPath;
+  std::cout << std::endl;
+  return 0;
+}
+
+} // namespace
 
 int main(int argc, char **argv) {
+  std::string renderPatch;
+  std::string outPath;
+  double seconds = 10.0;
+  int threads = 0;
+  AudioConfig config;
+  std::string filename;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--render" && hasValue) {
+      renderPatch = argv[++i];
+    } else if (arg == "--seconds" && hasValue) {
+      seconds = std::atof(argv[++i]);
+    } else if (arg == "--out" && hasValue) {
+      outPath = argv[++i];
+    } else if (arg == "--threads" && hasValue) {
+      threads = std::atoi(argv[++i]);
+    } else if (arg == "--rate" && hasValue) {
+      config.sampleRate = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (arg == "--period" && hasValue) {
+      config.periodFrames = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (arg == "--periods" && hasValue) {
+      config.periods = static_cast<uint32_t>(std::atoi(argv[++i]));
+    } else if (arg.rfind("--", 0) == 0) {
+      return usage(argv[0]);
+    } else {
+      filename = arg;
+    }
+  }
+
+  if (!renderPatch.empty())
+    return runOffline(renderPatch, seconds, outPath, threads, config);
+
+  // the voices and pattern engine outlive the device that reads them
   Graph graph;
-  AudioEngine aEngine(graph);
+  VoiceManager voices(graph, VOICES_PER_TEMPLATE);
   PatternEngine pEngine;
-  LuaEngine lEngine(graph, aEngine, pEngine);
+  pEngine.setHandler(&voices);
+  AudioEngine aEngine(graph, true, config);
+  aEngine.setPatternEngine(&pEngine);
+  aEngine.setVoiceManager(&voices);
+  aEngine.setThreads(threads);
+  Sequencer sequencer(aEngine, pEngine);
+  sequencer.start();
+  LuaEngine lEngine(graph, aEngine, pEngine, sequencer);
 
-  if (argc > 1) {
-    std::string filename = argv[1];
+  if (!filename.empty()) {
     lEngine.runFile(filename);
   }
 
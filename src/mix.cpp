@@ -0,0 +1,117 @@
+#include "mix.h"
+
+#include <cmath>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define TAKYON_X86 1
+#include <immintrin.h>
+#endif
+
+static_assert(DEVICE_CHANNELS == 2, "the mix bus is stereo");
+
+void SinkStrip::set(float gain_, float pan_) {
+  float p = std::fmin(std::fmax(pan_, -1.0f), 1.0f);
+  float angle = (p + 1.0f) * 0.25f * 3.14159265358979f;
+  float scale = gain_ * 1.41421356237310f;
+  gain.store(gain_, std::memory_order_relaxed);
+  pan.store(p, std::memory_order_relaxed);
+  left.store(scale * std::cos(angle), std::memory_order_relaxed);
+  right.store(scale * std::sin(angle), std::memory_order_relaxed);
+}
+
+namespace {
+
+// left[i] += in[i] * (l0 + dl * (i + 1)), and the same for right: the gain
+// reaches its target on the last frame of the block.
+void accumulate(const float *in, int frames, float l0, float dl, float r0,
+                float dr, float *left, float *right) {
+  int i = 0;
+#ifdef TAKYON_X86
+  if (dl == 0.0f && dr == 0.0f) {
+    // steady gain, the usual case
+    const __m128 gl = _mm_set1_ps(l0);
+    const __m128 gr = _mm_set1_ps(r0);
+    for (; i + 4 <= frames; i += 4) {
+      __m128 x = _mm_load_ps(in + i);
+      _mm_store_ps(left + i,
+                   _mm_add_ps(_mm_load_ps(left + i), _mm_mul_ps(x, gl)));
+      _mm_store_ps(right + i,
+                   _mm_add_ps(_mm_load_ps(right + i), _mm_mul_ps(x, gr)));
+    }
+  } else {
+    const __m128 step = _mm_setr_ps(1.0f, 2.0f, 3.0f, 4.0f);
+    __m128 gl = _mm_add_ps(_mm_set1_ps(l0), _mm_mul_ps(_mm_set1_ps(dl), step));
+    __m128 gr = _mm_add_ps(_mm_set1_ps(r0), _mm_mul_ps(_mm_set1_ps(dr), step));
+    const __m128 dl4 = _mm_set1_ps(4.0f * dl);
+    const __m128 dr4 = _mm_set1_ps(4.0f * dr);
+    for (; i + 4 <= frames; i += 4) {
+      __m128 x = _mm_load_ps(in + i);
+      _mm_store_ps(left + i,
+                   _mm_add_ps(_mm_load_ps(left + i), _mm_mul_ps(x, gl)));
+      _mm_store_ps(right + i,
+                   _mm_add_ps(_mm_load_ps(right + i), _mm_mul_ps(x, gr)));
+      gl = _mm_add_ps(gl, dl4);
+      gr = _mm_add_ps(gr, dr4);
+    }
+  }
+#endif
+  for (; i < frames; i++) {
+    float k = static_cast<float>(i + 1);
+    left[i] += in[i] * (l0 + dl * k);
+    right[i] += in[i] * (r0 + dr * k);
+  }
+}
+
+} // namespace
+
+void MixBus::mix(const std::vector<Node *> &sinks, int frames) {
+  for (int i = 0; i < frames; i++) {
+    left[i] = 0.0f;
+    right[i] = 0.0f;
+  }
+
+  bool soloed = false;
+  for (const Node *node : sinks)
+    soloed |= node->strip.solo.load(std::memory_order_relaxed);
+
+  const float perFrame = 1.0f / static_cast<float>(frames);
+  for (Node *node : sinks) {
+    const SinkStrip &strip = node->strip;
+    bool audible = !strip.mute.load(std::memory_order_relaxed) &&
+                   (!soloed || strip.solo.load(std::memory_order_relaxed));
+    float l = 0.0f;
+    float r = 0.0f;
+    if (audible) {
+      l = strip.left.load(std::memory_order_relaxed);
+      r = strip.right.load(std::memory_order_relaxed);
+    }
+
+    float l0 = node->busGain[0];
+    float r0 = node->busGain[1];
+    node->busGain[0] = l;
+    node->busGain[1] = r;
+    // A silent node's block is zeros: nothing to add, but its gain keeps
+    // tracking the strip so waking up sounds at full level at once.
+    if (node->silent || (l0 == 0.0f && r0 == 0.0f && l == 0.0f && r == 0.0f))
+      continue;
+    accumulate(node->out, frames, l0, (l - l0) * perFrame, r0,
+               (r - r0) * perFrame, left, right);
+  }
+}
+
+void MixBus::interleave(float *out, int frames) const {
+  int i = 0;
+#ifdef TAKYON_X86
+  // the device buffer carries no alignment guarantee
+  for (; i + 4 <= frames; i += 4) {
+    __m128 l = _mm_load_ps(left + i);
+    __m128 r = _mm_load_ps(right + i);
+    _mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(l, r));
+    _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(l, r));
+  }
+#endif
+  for (; i < frames; i++) {
+    out[2 * i] = left[i];
+    out[2 * i + 1] = right[i];
+  }
+}
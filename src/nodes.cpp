@@ -1,67 +1,244 @@
 #include "nodes.h"
 
+#include "dispatch.h"
+#include "rate.h"
+
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
-void ControlNode::addTarget(std::atomic<float> *target) {
-  if (target)
-    targets.push_back(target);
+namespace {
+
+constexpr float TWO_PI = 2.0f * M_PI;
+
+// LFO shapes are left naive on purpose: stepped and ramped modulation wants
+// hard edges (at control rate an edge spans one tick). `p` is the phase
+// normalized to [0, 1).
+template <Waveform W> inline float shapeAt(const float *sine, float p) {
+  if constexpr (W == Waveform::Sine)
+    return Wavetable::lookup(sine, p);
+  else if constexpr (W == Waveform::Saw)
+    return 2.0f * p - 1.0f; // ramps from -1 to 1
+  else if constexpr (W == Waveform::InvSaw)
+    return 1.0f - 2.0f * p; // ramps from -1 to 1
+  else if constexpr (W == Waveform::Square)
+    return (p < 0.5f) ? 1.0f : -1.0f;
+  else
+    return 4.0f * fabsf(p - 0.5f) - 1.0f;
+}
+
+// Wrap to [0, 1) for any finite phase (truncation is cheaper than floorf).
+inline float wrapPhase(float p) {
+  p -= static_cast<float>(static_cast<int>(p));
+  return p < 0.0f ? p + 1.0f : p;
+}
+
+// Unwrapped phases for the block, ph[i] being the phase at frame i. A
+// constant frequency gives a closed form; a modulated one needs the running
+// sum but keeps it to one add per sample. Returns the wrapped end phase.
+float advancePhases(float *ph, int frames, float start,
+                    const ModParam::Snapshot &freq, float invRate) {
+  if (freq.source) {
+    float p = start;
+    for (int i = 0; i < frames; i++) {
+      p += freq.source[i] * invRate;
+      ph[i] = p;
+    }
+  } else {
+    const float inc = freq.value * invRate;
+    for (int i = 0; i < frames; i++)
+      ph[i] = start + static_cast<float>(i + 1) * inc;
+  }
+  return wrapPhase(ph[frames - 1]);
+}
+
+// Band-limited table oscillator sample i over precomputed phases.
+template <bool Cubic, bool AmpModulated>
+inline float tableAt(const float *table, const float *ph,
+                     const ModParam::Snapshot &amp, int i) {
+  float p = wrapPhase(ph[i]);
+  float v = Cubic ? Wavetable::lookupCubic(table, p)
+                  : Wavetable::lookup(table, p);
+  return paramAt<AmpModulated>(amp, i) * v;
+}
+
+// With no sample-to-sample dependency left the loop vectorizes.
+template <bool Cubic, bool AmpModulated>
+void renderTable(float *out, int frames, const float *table, const float *ph,
+                 const ModParam::Snapshot &amp) {
+  for (int i = 0; i < frames; i++)
+    out[i] = tableAt<Cubic, AmpModulated>(table, ph, amp, i);
+}
+
+// Audio-rate LFO over precomputed phases. Constant parameters stay scalars;
+// once any is modulated all three are read as blocks.
+template <Waveform W, bool Modulated>
+void renderLfo(float *out, int frames, const float *sine, const float *ph,
+               const ModParam::Snapshot &base, const ModParam::Snapshot &amp,
+               const ModParam::Snapshot &shift) {
+  if constexpr (Modulated) {
+    float scratch[3][BLOCK_SIZE];
+    const float *b = paramBlock(base, scratch[0], frames);
+    const float *a = paramBlock(amp, scratch[1], frames);
+    const float *s = paramBlock(shift, scratch[2], frames);
+    for (int i = 0; i < frames; i++) {
+      float p = wrapPhase(ph[i] + s[i] * (1.0f / TWO_PI));
+      out[i] = b[i] + a[i] * shapeAt<W>(sine, p);
+    }
+  } else {
+    const float b = base.value;
+    const float a = amp.value;
+    const float cycles = shift.value * (1.0f / TWO_PI);
+    for (int i = 0; i < frames; i++)
+      out[i] = b + a * shapeAt<W>(sine, wrapPhase(ph[i] + cycles));
+  }
+}
+
+// RBJ biquad low-pass, coefficients normalized by a0.
+void designLowPass(float fc, float Q, float invRate, float &b0, float &b1,
+                   float &b2, float &a1, float &a2) {
+  float w0 = TWO_PI * fc * invRate;
+  float cosw0 = cosf(w0);
+  float sinw0 = sinf(w0);
+  float alpha = sinw0 / (2.0f * Q);
+  float invA0 = 1.0f / (1.0f + alpha);
+
+  b1 = (1.0f - cosw0) * invA0;
+  b0 = b2 = b1 * 0.5f;
+  a1 = -2.0f * cosw0 * invA0;
+  a2 = (1.0f - alpha) * invA0;
+}
+
+} // namespace
+
+std::atomic<int> ControlNode::defaultDecimation{1};
+
+int ControlNode::controlInterval() const {
+  int d = decimation.load(std::memory_order_relaxed);
+  if (d <= 0)
+    d = defaultDecimation.load(std::memory_order_relaxed);
+  return std::clamp(d, 1, MAX_DECIMATION);
+}
+
+void ControlNode::addTarget(ModParam *target, Node *owner) {
+  if (!target)
+    return;
+  for (const Param &t : targets)
+    if (t.ptr == target)
+      return;
+  targets.push_back({target, owner});
+}
+
+void ControlNode::detach(Node *other) {
+  for (auto &t : targets) {
+    if (t.owner != other)
+      continue;
+    // only release params still driven by this node
+    const float *expected = out;
+    t.ptr->source.compare_exchange_strong(expected, nullptr,
+                                          std::memory_order_relaxed);
+  }
+  targets.erase(std::remove_if(targets.begin(), targets.end(),
+                               [other](const Param &t) {
+                                 return t.owner == other;
+                               }),
+                targets.end());
 }
 
-void EffectNode::addInput(std::atomic<float> *input) {
-  if (input)
+void EffectNode::addInput(const Node *input) {
+  if (input && std::find(inputs.begin(), inputs.end(), input) == inputs.end())
     inputs.push_back(input);
 }
 
+const std::vector<const Node *> &EffectNode::audioInputs() const {
+  return inputs;
+}
+
+void EffectNode::detach(Node *other) {
+  inputs.erase(std::remove(inputs.begin(), inputs.end(), other), inputs.end());
+}
+
 std::unique_ptr<Oscillator> Oscillator::init(float amp_, float freq_,
                                              Waveform type_) {
   auto osc = std::make_unique<Oscillator>();
-  osc->amp.store(amp_);
-  osc->freq.store(freq_);
+  osc->amp.set(amp_);
+  osc->freq.set(freq_);
   osc->type = type_;
   osc->sinked.store(false);
   std::cout << "new Oscillator: amp=" << amp_ << " freq=" << freq_ << std::endl;
   return osc;
 }
 
-void Oscillator::update() {
-  float freqIncrement = 2.0f * M_PI * freq.load() / DEVICE_SAMPLE_RATE;
-  float newPhase = phase.load() + freqIncrement;
-
-  if (newPhase >= 2.0f * M_PI)
-    newPhase -= 2.0f * M_PI;
-  phase.store(newPhase);
-
-  float value = 0.0f;
-  float p = phase.load() / (2.0f * M_PI); // normalized 0..1
-
-  switch (type) {
-  case Waveform::Sine:
-    value = sinf(phase.load());
-    break;
-  case Waveform::Saw:
-    value = 2.0f * p - 1.0f; // ramps from -1 to 1
-    break;
-  case Waveform::InvSaw:
-    value = 1.0f - 2.0f * p; // ramps from -1 to 1
-    break;
-  case Waveform::Square:
-    value = (p < 0.5f) ? 1.0f : -1.0f;
-    break;
-  case Waveform::Triangle:
-    value = 4.0f * fabs(p - 0.5f) - 1.0f;
-    break;
+template <typename Kernel>
+void Oscillator::render(int frames, Kernel &&kernel) {
+  // Parameters are sampled once per block; modulated ones read the
+  // controller's block sample by sample.
+  const ModParam::Snapshot a = amp.read();
+  const ModParam::Snapshot f = freq.read();
+  const float invRate = SampleRate::get().inv;
+
+  const Wavetable *wt = table.load(std::memory_order_relaxed);
+  if (!wt)
+    wt = &Wavetable::get(type.load(std::memory_order_relaxed));
+
+  // pick the mip level for the fastest frequency in the block
+  float maxFreq = fabsf(f.value);
+  if (f.source) {
+    maxFreq = 0.0f;
+    for (int i = 0; i < frames; i++)
+      maxFreq = std::max(maxFreq, fabsf(f.source[i]));
   }
+  const float *t = wt->level(Wavetable::levelFor(maxFreq * invRate));
+
+  float ph[BLOCK_SIZE];
+  phase = advancePhases(ph, frames, phase, f, invRate);
+
+  bool cubic = interp.load(std::memory_order_relaxed) == Interpolation::Cubic;
+  withFlag(cubic, [&](auto c) {
+    withFlag(a.source != nullptr, [&](auto m) { kernel(c, m, t, ph, a); });
+  });
+}
 
-  out.store(amp.load() * value);
+void Oscillator::process(const Block &block) {
+  render(block.frames, [&](auto c, auto m, const float *t, const float *ph,
+                           const ModParam::Snapshot &a) {
+    renderTable<decltype(c)::value, decltype(m)::value>(out, block.frames, t,
+                                                        ph, a);
+  });
+}
+
+bool Oscillator::sleeps(const Block &block, bool /*inputsSilent*/) {
+  const ModParam::Snapshot a = amp.read();
+  if (a.source || a.value != 0.0f)
+    return false;
+  // keep time, so layers faded back in are still in phase with each other
+  const ModParam::Snapshot f = freq.read();
+  const float invRate = SampleRate::get().inv;
+  if (f.source) {
+    float ph[BLOCK_SIZE];
+    phase = advancePhases(ph, block.frames, phase, f, invRate);
+  } else {
+    // advancePhases' last frame, without the rest of the block
+    phase = wrapPhase(phase + static_cast<float>(block.frames) *
+                                  (f.value * invRate));
+  }
+  return true;
+}
+
+void Oscillator::reset() { phase = 0.0f; }
+
+void Oscillator::adopt(const Node &previous) {
+  if (auto *p = dynamic_cast<const Oscillator *>(&previous))
+    phase = p->phase;
 }
 
 std::unique_ptr<LFO> LFO::init(float base_, float amp_, float freq_,
                                float shift_, Waveform type_) {
   auto lfo = std::make_unique<LFO>();
-  lfo->base.store(base_);
-  lfo->amp.store(amp_);
-  lfo->freq.store(freq_);
-  lfo->shift.store(shift_);
+  lfo->base.set(base_);
+  lfo->amp.set(amp_);
+  lfo->freq.set(freq_);
+  lfo->shift.set(shift_);
   lfo->type = type_;
   lfo->sinked.store(false);
 
@@ -70,102 +247,205 @@ std::unique_ptr<LFO> LFO::init(float base_, float amp_, float freq_,
   return lfo;
 }
 
-void LFO::update() {
-  float freqIncrement = 2.0f * M_PI * freq.load() / DEVICE_SAMPLE_RATE;
-  float newPhase = phase.load() + freqIncrement;
+void LFO::process(const Block &block) {
+  withWaveform(type.load(std::memory_order_relaxed), [&](auto w) {
+    render<decltype(w)::value>(block.frames);
+  });
+  // targets read `out` directly through their ModParam::source
+}
 
-  if (newPhase >= 2.0f * M_PI) {
-    newPhase -= 2.0f * M_PI;
-  }
-  phase.store(newPhase);
-
-  float adjustedPhase = phase.load(std::memory_order_relaxed) +
-                        shift.load(std::memory_order_relaxed);
-
-  adjustedPhase = fmodf(adjustedPhase, 2.0f * M_PI);
-  if (adjustedPhase < 0.0f)
-    adjustedPhase += 2.0f * M_PI;
-
-  float value = 0.0f;
-  float p = adjustedPhase / (2.0f * M_PI); // normalized 0..1
-
-  switch (type) {
-  case Waveform::Sine:
-    value = sinf(adjustedPhase);
-    break;
-  case Waveform::Saw:
-    value = 2.0f * p - 1.0f; // ramps from -1 to 1
-    break;
-  case Waveform::InvSaw:
-    value = 1.0f - 2.0f * p; // ramps from -1 to 1
-    break;
-  case Waveform::Square:
-    value = (p < 0.5f) ? 1.0f : -1.0f;
-    break;
-  case Waveform::Triangle:
-    value = 4.0f * fabs(p - 0.5f) - 1.0f;
-    break;
-  }
+template <Waveform W> void LFO::render(int frames) {
+  const ModParam::Snapshot b = base.read();
+  const ModParam::Snapshot a = amp.read();
+  const ModParam::Snapshot f = freq.read();
+  const ModParam::Snapshot s = shift.read();
+  const float invRate = SampleRate::get().inv;
+  const float *sine = Wavetable::get(Waveform::Sine).level(0);
+
+  const int interval = controlInterval();
+  if (interval == 1) {
+    float ph[BLOCK_SIZE];
+    phase = advancePhases(ph, frames, phase, f, invRate);
+    bool modulated = b.source || a.source || s.source;
+    withFlag(modulated, [&](auto m) {
+      renderLfo<W, decltype(m)::value>(out, frames, sine, ph, b, a, s);
+    });
+    // let a switch to control rate carry on from here
+    current = out[frames - 1];
+    countdown = 0;
+    primed = true;
+  } else {
+    // value at phase `p` with the parameters found at frame i
+    auto valueAt = [&](float p, int i) {
+      // shift is in radians
+      p = wrapPhase(p + s.at(i) / TWO_PI);
+      return b.at(i) + a.at(i) * shapeAt<W>(sine, p);
+    };
 
-  float result = base.load(std::memory_order_relaxed) +
-                 amp.load(std::memory_order_relaxed) * value;
-  out.store(result, std::memory_order_relaxed);
-  for (auto *t : targets) {
-    t->store(out.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    // Control rate: one evaluation per tick, `phase` runs a tick ahead and
+    // `out` ramps onto it, so every tick lands exactly on the true value.
+    for (int i = 0; i < frames;) {
+      if (countdown == 0) {
+        if (!primed) {
+          current = valueAt(phase, i);
+          primed = true;
+        }
+        phase = wrapPhase(phase + f.at(i) * interval * invRate);
+        slope = (valueAt(phase, i) - current) / interval;
+        countdown = interval;
+      }
+      int n = std::min(countdown, frames - i);
+      for (int k = 0; k < n; k++)
+        out[i + k] = current + slope * (k + 1);
+      current += slope * n;
+      countdown -= n;
+      i += n;
+    }
   }
 }
 
+void LFO::reset() {
+  phase = 0.0f;
+  countdown = 0;
+  primed = false;
+}
+
+void LFO::adopt(const Node &previous) {
+  auto *p = dynamic_cast<const LFO *>(&previous);
+  if (!p)
+    return;
+  phase = p->phase;
+  current = p->current;
+  slope = p->slope;
+  countdown = p->countdown;
+  primed = p->primed;
+}
+
 std::unique_ptr<Filter> Filter::init(float cutoff_, float q_) {
   auto filter = std::make_unique<Filter>();
-  filter->cutoff.store(cutoff_);
-  filter->q.store(q_);
+  filter->cutoff.set(cutoff_);
+  filter->q.set(q_);
   filter->sinked.store(false);
   std::cout << "new Filter: cutoff=" << cutoff_ << " q=" << q_ << std::endl;
   return filter;
 }
 
-void Filter::update() {
-  if (inputs.empty()) {
-    out.store(0.0f, std::memory_order_relaxed);
+void Filter::reset() {
+  x1 = x2 = y1 = y2 = 0.0f;
+  designedCutoff = designedQ = -1.0f; // snap to the current design
+}
+
+void Filter::adopt(const Node &previous) {
+  auto *p = dynamic_cast<const Filter *>(&previous);
+  if (!p)
     return;
-  }
+  x1 = p->x1, x2 = p->x2, y1 = p->y1, y2 = p->y2;
+  // ramp from the old coefficients if the new cutoff/q differ
+  b0 = p->b0, b1 = p->b1, b2 = p->b2, a1 = p->a1, a2 = p->a2;
+  designedCutoff = p->designedCutoff;
+  designedQ = p->designedQ;
+}
 
-  // Mix all upstream audio inputs
-  float acc = 0.0f;
-  for (auto *in : inputs) {
-    acc += in->load(std::memory_order_relaxed);
-  }
-  float input = acc / inputs.size();
+bool Filter::sleeps(const Block & /*block*/, bool inputsSilent) {
+  if (!inputsSilent || std::fabs(x1) > TAIL || std::fabs(x2) > TAIL ||
+      std::fabs(y1) > TAIL || std::fabs(y2) > TAIL)
+    return false;
+  x1 = x2 = y1 = y2 = 0.0f;
+  return true;
+}
 
-  // Read parameters (atomic-safe)
-  float fc = cutoff.load(std::memory_order_relaxed);
-  float resonance = q.load(std::memory_order_relaxed);
+template <typename Input> void Filter::render(int frames, Input &&input) {
+  float fc = cutoff.read().at(frames - 1);
+  float Q = q.read().at(frames - 1);
 
   // Constrain parameters to sensible ranges
-  fc = std::clamp(fc, 10.0f, DEVICE_SAMPLE_RATE * 0.45f);
-  float Q = std::max(0.1f, resonance);
+  const SampleRate &rate = SampleRate::get();
+  fc = std::clamp(fc, 10.0f, rate.nyquist * 0.9f);
+  Q = std::max(0.1f, Q);
 
-  // RBJ biquad low-pass coefficients
-  float w0 = 2.0f * M_PI * fc / DEVICE_SAMPLE_RATE;
-  float cosw0 = cosf(w0);
-  float sinw0 = sinf(w0);
-  float alpha = sinw0 / (2.0f * Q);
+  // Coefficients are designed once per block for the parameters at its last
+  // frame, and only when those moved audibly since the previous design.
+  float nb0 = b0, nb1 = b1, nb2 = b2, na1 = a1, na2 = a2;
+  bool moved = std::fabs(fc - designedCutoff) > designedCutoff * 1e-4f ||
+               std::fabs(Q - designedQ) > 1e-4f;
+  if (moved) {
+    designLowPass(fc, Q, rate.inv, nb0, nb1, nb2, na1, na2);
+    if (designedCutoff < 0.0f) {
+      // first block: start on the target instead of ramping from zero
+      b0 = nb0, b1 = nb1, b2 = nb2, a1 = na1, a2 = na2;
+    }
+    designedCutoff = fc;
+    designedQ = Q;
+  }
 
-  float b0 = (1.0f - cosw0) * 0.5f;
-  float b1 = 1.0f - cosw0;
-  float b2 = (1.0f - cosw0) * 0.5f;
-  float a0 = 1.0f + alpha;
-  float a1 = -2.0f * cosw0;
-  float a2 = 1.0f - alpha;
+  float cb0 = b0, cb1 = b1, cb2 = b2, ca1 = a1, ca2 = a2;
+  float sx1 = x1, sx2 = x2, sy1 = y1, sy2 = y2;
 
-  // Direct Form I biquad
-  float y = (b0 / a0) * input + (b1 / a0) * x1 + (b2 / a0) * x2 -
-            (a1 / a0) * y1 - (a2 / a0) * y2;
+  if (cb0 == nb0 && cb1 == nb1 && cb2 == nb2 && ca1 == na1 && ca2 == na2) {
+    for (int i = 0; i < frames; i++) {
+      float x = input(i);
+      float y = cb0 * x + cb1 * sx1 + cb2 * sx2 - ca1 * sy1 - ca2 * sy2;
+      sx2 = sx1, sx1 = x, sy2 = sy1, sy1 = y;
+      out[i] = y;
+    }
+  } else {
+    // Ramp the coefficients linearly across the block so cutoff jumps do not
+    // click. The low-pass (a1, a2) stability region is convex, so every
+    // point between two stable designs is stable too.
+    float step = 1.0f / frames;
+    float db0 = (nb0 - cb0) * step, db1 = (nb1 - cb1) * step,
+          db2 = (nb2 - cb2) * step, da1 = (na1 - ca1) * step,
+          da2 = (na2 - ca2) * step;
+    for (int i = 0; i < frames; i++) {
+      cb0 += db0, cb1 += db1, cb2 += db2, ca1 += da1, ca2 += da2;
+      float x = input(i);
+      float y = cb0 * x + cb1 * sx1 + cb2 * sx2 - ca1 * sy1 - ca2 * sy2;
+      sx2 = sx1, sx1 = x, sy2 = sy1, sy1 = y;
+      out[i] = y;
+    }
+    // land exactly on the design to re-enter the constant path next block
+    b0 = nb0, b1 = nb1, b2 = nb2, a1 = na1, a2 = na2;
+  }
 
-  x2 = x1;
-  x1 = input;
-  y2 = y1;
-  y1 = y;
+  x1 = sx1, x2 = sx2, y1 = sy1, y2 = sy2;
+}
+
+void Filter::process(const Block &block) {
+  const int frames = block.frames;
+  if (block.numInputs == 0) {
+    std::fill(out, out + frames, 0.0f);
+    return;
+  }
+  if (block.numInputs == 1) {
+    const float *in = block.inputs[0];
+    render(frames, [in](int i) { return in[i]; });
+    return;
+  }
+
+  // Mix all upstream audio inputs
+  float mix[BLOCK_SIZE];
+  std::copy(block.inputs[0], block.inputs[0] + frames, mix);
+  for (int n = 1; n < block.numInputs; n++) {
+    const float *in = block.inputs[n];
+    for (int i = 0; i < frames; i++)
+      mix[i] += in[i];
+  }
+  float inputGain = 1.0f / block.numInputs;
+  render(frames, [&](int i) { return mix[i] * inputGain; });
+}
+
+bool Oscillator::fusesWith(const Node &next) const {
+  return dynamic_cast<const Filter *>(&next) != nullptr;
+}
 
-  out.store(y, std::memory_order_relaxed);
+void Oscillator::processFused(const Block &block, Node &next) {
+  auto &filter = static_cast<Filter &>(next);
+  render(block.frames, [&](auto c, auto m, const float *t, const float *ph,
+                           const ModParam::Snapshot &a) {
+    filter.render(block.frames, [&](int i) {
+      float v = tableAt<decltype(c)::value, decltype(m)::value>(t, ph, a, i);
+      out[i] = v;
+      return v;
+    });
+  });
 }
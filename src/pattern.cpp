@@ -0,0 +1,74 @@
+#include "pattern.h"
+
+#include <algorithm>
+
+// std heap algorithms build a max-heap; invert for earliest-first.
+bool PatternEngine::later(const Pending &a, const Pending &b) {
+  if (a.event.tsSamples != b.event.tsSamples)
+    return a.event.tsSamples > b.event.tsSamples;
+  return a.seq > b.seq;
+}
+
+bool PatternEngine::schedule(const Event &event) {
+  Event stamped = event;
+  stamped.epoch = currentEpoch();
+  return eventQueue.push(stamped);
+}
+
+size_t PatternEngine::schedule(const Event *events, size_t count) {
+  return eventQueue.push(events, count);
+}
+
+void PatternEngine::setHandler(EventHandler *h) {
+  handler.store(h, std::memory_order_release);
+}
+
+void PatternEngine::drain() {
+  uint32_t current = epoch.load(std::memory_order_acquire);
+  if (current != seenEpoch) {
+    seenEpoch = current;
+    pendingCount = 0; // flushed
+  }
+
+  // leave the rest in the ring if the heap is full
+  while (pendingCount < QUEUE_CAPACITY &&
+         eventQueue.pop(pending[pendingCount].event)) {
+    if (pending[pendingCount].event.epoch != current)
+      continue;
+    pending[pendingCount].seq = nextSeq++;
+    pendingCount++;
+    std::push_heap(pending, pending + pendingCount, later);
+  }
+}
+
+uint32_t PatternEngine::framesUntilNext(uint64_t now, uint32_t limit) {
+  drain();
+  if (pendingCount == 0)
+    return limit;
+  uint64_t ts = pending[0].event.tsSamples;
+  if (ts <= now)
+    return 0;
+  return static_cast<uint32_t>(std::min<uint64_t>(ts - now, limit));
+}
+
+bool PatternEngine::dispatchDue(uint64_t now) {
+  drain();
+  EventHandler *h = handler.load(std::memory_order_acquire);
+  bool dispatched = false;
+  while (pendingCount > 0 && pending[0].event.tsSamples <= now) {
+    std::pop_heap(pending, pending + pendingCount, later);
+    pendingCount--;
+    const Event &event = pending[pendingCount].event;
+    if (event.type == SetValue) {
+      // the scalar only: a controller attached since keeps the param
+      event.setValue.param->value.store(event.setValue.value,
+                                        std::memory_order_relaxed);
+    } else if (h)
+      h->handleEvent(event);
+    dispatched = true;
+
+    // the handler may have freed room for more of the ring
+    drain();
+  }
+  return dispatched;
+}
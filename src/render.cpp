@@ -0,0 +1,73 @@
+#include "render.h"
+
+#include "globals.h"
+#include "rate.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+namespace {
+
+constexpr ma_uint32 RENDER_CHUNK_FRAMES = 4096;
+
+} // namespace
+
+bool renderOffline(AudioEngine &engine, double seconds,
+                   const std::filesystem::path &outPath, RenderStats &stats,
+                   Sequencer *sequencer) {
+  stats = RenderStats{};
+  if (seconds <= 0.0)
+    return true;
+
+  const float rate = SampleRate::get().hz;
+  ma_encoder encoder;
+  bool writing = !outPath.empty();
+  if (writing) {
+    ma_encoder_config config =
+        ma_encoder_config_init(ma_encoding_format_wav, DEVICE_FORMAT,
+                               DEVICE_CHANNELS, static_cast<ma_uint32>(rate));
+    if (ma_encoder_init_file(outPath.c_str(), &config, &encoder) !=
+        MA_SUCCESS) {
+      std::cerr << "Could not open " << outPath << " for writing" << std::endl;
+      return false;
+    }
+  }
+
+  const ma_uint64 totalFrames =
+      static_cast<ma_uint64>(seconds * rate);
+  std::vector<float> buffer(RENDER_CHUNK_FRAMES * DEVICE_CHANNELS);
+
+  using clock = std::chrono::steady_clock;
+  clock::duration elapsed{};
+  bool ok = true;
+
+  ma_uint64 done = 0; // rendered and, when writing, written
+  while (done < totalFrames) {
+    ma_uint32 frames = static_cast<ma_uint32>(
+        std::min<ma_uint64>(RENDER_CHUNK_FRAMES, totalFrames - done));
+
+    if (sequencer)
+      sequencer->pump();
+    auto start = clock::now();
+    engine.render(buffer.data(), frames);
+    auto took = clock::now() - start;
+
+    if (writing && ma_encoder_write_pcm_frames(&encoder, buffer.data(), frames,
+                                               nullptr) != MA_SUCCESS) {
+      std::cerr << "Failed writing " << outPath << std::endl;
+      ok = false;
+      break;
+    }
+    elapsed += took;
+    done += frames;
+  }
+
+  if (writing)
+    ma_encoder_uninit(&encoder);
+
+  stats.audioSeconds = static_cast<double>(done) / rate;
+  stats.renderSeconds = std::chrono::duration<double>(elapsed).count();
+  return ok;
+}
@@ -0,0 +1,234 @@
+#include "sequencer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+
+// Thread wake-ups per lookahead window: the queue keeps at least three
+// quarters of a window ahead of the audio clock.
+constexpr double WAKES_PER_WINDOW = 4.0;
+constexpr std::chrono::milliseconds MAX_SLEEP{250};
+
+} // namespace
+
+// --- TempoMap ---------------------------------------------------------------
+
+void TempoMap::reset(double beat, double sample, double bpm, float rate) {
+  sampleRate = rate;
+  segments.assign(1, {beat, sample, 60.0 * rate / bpm});
+  cached = 0;
+}
+
+void TempoMap::setTempo(double beat, double bpm) {
+  double sample = sampleAt(beat);
+  while (segments.size() > 1 && segments.back().beat >= beat)
+    segments.pop_back();
+  if (segments.back().beat >= beat)
+    segments.back() = {beat, sample, 60.0 * sampleRate / bpm};
+  else
+    segments.push_back({beat, sample, 60.0 * sampleRate / bpm});
+  cached = 0;
+}
+
+const TempoMap::Segment &TempoMap::segmentFor(double beat) const {
+  if (cached >= segments.size() || segments[cached].beat > beat)
+    cached = 0;
+  while (cached + 1 < segments.size() && segments[cached + 1].beat <= beat)
+    cached++;
+  return segments[cached];
+}
+
+double TempoMap::sampleAt(double beat) const {
+  const Segment &s = segmentFor(beat);
+  return s.sample + (beat - s.beat) * s.samplesPerBeat;
+}
+
+double TempoMap::beatAt(double sample) const {
+  size_t k = segments.size() - 1;
+  while (k > 0 && segments[k].sample > sample)
+    k--;
+  const Segment &s = segments[k];
+  return s.beat + (sample - s.sample) / s.samplesPerBeat;
+}
+
+double TempoMap::tempo() const {
+  return 60.0 * sampleRate / segments.back().samplesPerBeat;
+}
+
+void TempoMap::prune(double beat) {
+  size_t first = 0;
+  while (first + 1 < segments.size() && segments[first + 1].beat <= beat)
+    first++;
+  segments.erase(segments.begin(), segments.begin() + first);
+  cached = 0;
+}
+
+// --- Sequencer --------------------------------------------------------------
+
+Sequencer::Sequencer(AudioEngine &audio, PatternEngine &events)
+    : audio(audio), events(events) {}
+
+Sequencer::~Sequencer() { stop(); }
+
+void Sequencer::start() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (thread.joinable())
+    return;
+  quit = false;
+  thread = std::thread(&Sequencer::run, this);
+}
+
+void Sequencer::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  wake.notify_all();
+  if (thread.joinable())
+    thread.join();
+}
+
+void Sequencer::startTransport() {
+  tempo.reset(0.0, static_cast<double>(audio.now()), bpm,
+              audio.sampleRate());
+  horizon = 0.0;
+  running = true;
+}
+
+double Sequencer::currentBeat() const {
+  return tempo.beatAt(static_cast<double>(audio.now()));
+}
+
+void Sequencer::setTempo(double newBpm) {
+  std::lock_guard<std::mutex> lock(mutex);
+  bpm = newBpm;
+  if (running)
+    tempo.setTempo(std::max(horizon, currentBeat()), bpm);
+  wake.notify_all();
+}
+
+double Sequencer::getTempo() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return bpm;
+}
+
+void Sequencer::setLookahead(double beats) {
+  std::lock_guard<std::mutex> lock(mutex);
+  lookahead = beats;
+  wake.notify_all();
+}
+
+double Sequencer::getLookahead() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return lookahead;
+}
+
+// Place the cursor on the first step at or after `beat`.
+void Sequencer::seek(Track &track, double beat) const {
+  const Pattern &p = track.pattern;
+  double loops = std::floor(std::max(beat, 0.0) / p.length);
+  double offset = beat - loops * p.length;
+  track.loop = static_cast<uint64_t>(loops);
+  track.index = std::lower_bound(p.steps.begin(), p.steps.end(), offset,
+                                 [](const Pattern::Step &s, double b) {
+                                   return s.beat < b;
+                                 }) -
+                p.steps.begin();
+  if (track.index == p.steps.size()) {
+    track.loop++;
+    track.index = 0;
+  }
+}
+
+void Sequencer::addTrack(ModParam *param, Pattern pattern) {
+  if (!param || pattern.steps.empty() || !(pattern.length > 0.0))
+    return;
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!running)
+    startTransport();
+  Track track{param, std::move(pattern)};
+  // start now rather than at the horizon: a step slightly in the past
+  // fires at the next block
+  seek(track, currentBeat());
+  tracks.push_back(std::move(track));
+  pumpLocked();
+  wake.notify_all();
+}
+
+size_t Sequencer::trackCount() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return tracks.size();
+}
+
+void Sequencer::dropTracks(size_t count) {
+  std::lock_guard<std::mutex> lock(mutex);
+  tracks.erase(tracks.begin(),
+               tracks.begin() + std::min(count, tracks.size()));
+  events.flush();
+  // the transport keeps running so a reloaded patch stays on the grid
+  if (!running)
+    return;
+  horizon = currentBeat();
+  for (Track &track : tracks)
+    seek(track, horizon);
+  pumpLocked();
+}
+
+void Sequencer::pump() {
+  std::lock_guard<std::mutex> lock(mutex);
+  pumpLocked();
+}
+
+void Sequencer::pumpLocked() {
+  if (!running || tracks.empty())
+    return;
+  const float rate = audio.sampleRate();
+  if (tempo.rate() != rate) {
+    // the device was reopened at another rate: re-anchor where we are
+    double beat = currentBeat();
+    tempo.reset(beat, static_cast<double>(audio.now()), bpm, rate);
+  }
+
+  double now = currentBeat();
+  double until = now + lookahead;
+  const size_t room = events.space();
+  const uint32_t epoch = events.currentEpoch();
+
+  batch.clear();
+  for (Track &track : tracks) {
+    const Pattern &p = track.pattern;
+    while (batch.size() < room) {
+      double beat = track.loop * p.length + p.steps[track.index].beat;
+      if (beat >= until)
+        break;
+      Event event{};
+      event.type = SetValue;
+      event.epoch = epoch;
+      event.tsSamples =
+          static_cast<uint64_t>(std::llround(tempo.sampleAt(beat)));
+      event.setValue = {track.param, p.steps[track.index].value};
+      batch.push_back(event);
+      if (++track.index == p.steps.size()) {
+        track.index = 0;
+        track.loop++;
+      }
+    }
+  }
+  events.schedule(batch.data(), batch.size()); // fits: at most `room`
+  horizon = std::max(horizon, until);
+  tempo.prune(now);
+}
+
+void Sequencer::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!quit) {
+    pumpLocked();
+    double seconds = lookahead * 60.0 / bpm / WAKES_PER_WINDOW;
+    auto sleep = std::min<std::chrono::milliseconds>(
+        MAX_SLEEP,
+        std::chrono::milliseconds(static_cast<long long>(seconds * 1000.0)));
+    wake.wait_for(lock, sleep);
+  }
+}
@@ -0,0 +1,63 @@
+#include "stats.h"
+
+#include <algorithm>
+
+namespace {
+
+// single-writer increment: no read-modify-write needed
+template <typename T> void bump(std::atomic<T> &counter, T by = 1) {
+  counter.store(counter.load(std::memory_order_relaxed) + by,
+                std::memory_order_relaxed);
+}
+
+} // namespace
+
+void CallbackStats::record(uint64_t busyNanos, uint64_t deadlineNanos) {
+  uint32_t requests = resetRequests.load(std::memory_order_relaxed);
+  if (requests != resetsDone) {
+    resetsDone = requests;
+    callbacks.store(0, std::memory_order_relaxed);
+    xruns.store(0, std::memory_order_relaxed);
+    busyTotal.store(0, std::memory_order_relaxed);
+    deadlineTotal.store(0, std::memory_order_relaxed);
+    peakLoad.store(0.0f, std::memory_order_relaxed);
+    for (std::atomic<uint64_t> &bin : histogram)
+      bin.store(0, std::memory_order_relaxed);
+  }
+
+  float load = deadlineNanos > 0
+                   ? static_cast<float>(busyNanos) / deadlineNanos
+                   : 0.0f;
+  int bin = std::min(static_cast<int>(load * BINS_PER_DEADLINE),
+                     HISTOGRAM_BINS - 1);
+
+  bump(callbacks);
+  if (busyNanos > deadlineNanos)
+    bump(xruns);
+  bump(busyTotal, busyNanos);
+  bump(deadlineTotal, deadlineNanos);
+  bump(histogram[bin]);
+  lastLoad.store(load, std::memory_order_relaxed);
+  if (load > peakLoad.load(std::memory_order_relaxed))
+    peakLoad.store(load, std::memory_order_relaxed);
+}
+
+CallbackStats::Snapshot CallbackStats::read() const {
+  Snapshot s;
+  s.callbacks = callbacks.load(std::memory_order_relaxed);
+  s.xruns = xruns.load(std::memory_order_relaxed);
+  s.lastLoad = lastLoad.load(std::memory_order_relaxed);
+  s.peakLoad = peakLoad.load(std::memory_order_relaxed);
+  uint64_t deadline = deadlineTotal.load(std::memory_order_relaxed);
+  if (deadline > 0)
+    s.meanLoad = static_cast<float>(
+        static_cast<double>(busyTotal.load(std::memory_order_relaxed)) /
+        deadline);
+  for (int i = 0; i < HISTOGRAM_BINS; i++)
+    s.histogram[i] = histogram[i].load(std::memory_order_relaxed);
+  return s;
+}
+
+void CallbackStats::reset() {
+  resetRequests.fetch_add(1, std::memory_order_relaxed);
+}
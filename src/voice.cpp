@@ -1,5 +1,10 @@
 #include "voice.h"
+#include "nodes.h"
+
+#include <algorithm>
 #include <atomic>
+#include <cmath>
+#include <iostream>
 
 VoiceTemplate::VoiceTemplate(std::vector<NodeSpec> nodes,
                              std::vector<EdgeSpec> edges,
@@ -7,14 +12,48 @@ VoiceTemplate::VoiceTemplate(std::vector<NodeSpec> nodes,
     : nodes_(std::move(nodes)), edges_(std::move(edges)),
       params_(std::move(params)) {}
 
-VoiceManager::VoiceManager(Graph &graph, int maxVoices)
-    : graph(graph), maxVoices(maxVoices) {
-  for (int i = 0; i < maxVoices; ++i) {
-    freeVoiceIds.push(i);
+void VoiceInstance::activate(uint64_t note, float pitch_) {
+  for (Node *node : voiceNodes) {
+    node->reset();
+    node->active.store(true, std::memory_order_relaxed);
+  }
+  state = VoiceState::Active;
+  startedAt = note;
+  pitch = pitch_;
+}
+
+void VoiceInstance::deactivate() {
+  for (Node *node : voiceNodes)
+    node->active.store(false, std::memory_order_relaxed);
+  state = VoiceState::Inactive;
+}
+
+float VoiceInstance::level() const {
+  // eight independent sums vectorize, one running sum would not
+  static_assert(BLOCK_SIZE % 8 == 0);
+  auto energy = [](const Node *node) {
+    float lanes[8] = {};
+    for (int i = 0; i < BLOCK_SIZE; i += 8)
+      for (int k = 0; k < 8; k++)
+        lanes[k] += node->out[i + k] * node->out[i + k];
+    float e = 0.0f;
+    for (float lane : lanes)
+      e += lane;
+    return e;
+  };
+  float level = 0.0f, unsinked = 0.0f;
+  for (const Node *node : voiceNodes) {
+    if (node->sinked.load(std::memory_order_relaxed))
+      level = std::max(level, energy(node));
+    else
+      unsinked = std::max(unsinked, energy(node));
   }
-  voiceInstances.resize(maxVoices);
+  return level > 0.0f ? level : unsinked;
 }
 
+VoiceManager::VoiceManager(Graph &graph, int maxVoices)
+    : maxVoices(maxVoices), graph(graph) {}
+
 VoiceManager::~VoiceManager() = default;
 
 int VoiceManager::registerTemplate(std::unique_ptr<VoiceTemplate> vt) {
@@ -23,6 +62,35 @@ int VoiceManager::registerTemplate(std::unique_ptr<VoiceTemplate> vt) {
   // no shared nodes yet, all values -1
   std::vector<int> sharedNodeVec(voiceTemplates.back()->nodes().size(), -1);
   sharedNodeIds.push_back(std::move(sharedNodeVec));
+
+  // Build the whole pool now, parked, so that notes never construct nodes.
+  // Stack capacity is reserved so freeVoice never reallocates.
+  const auto &specs = voiceTemplates[id]->nodes();
+  std::vector<int> &freeIds = freeVoiceIds.emplace_back();
+  freeIds.reserve(maxVoices);
+  for (int v = 0; v < maxVoices; v++) {
+    int voiceId = static_cast<int>(voiceInstances.size());
+    auto instance = std::make_unique<VoiceInstance>();
+    instance->setIds(voiceId, id);
+
+    std::vector<int> nodeIds = instantiateNodes(id);
+    std::vector<Node *> voiceNodes;
+    for (size_t i = 0; i < specs.size(); i++) {
+      if (specs[i].syncMode == SyncMode::PerVoice)
+        voiceNodes.push_back(graph.getNodes()[nodeIds[i]].get());
+    }
+    instance->setBindings(instantiateParams(id, nodeIds));
+    instance->setNodeIds(std::move(nodeIds));
+    instance->setVoiceNodes(std::move(voiceNodes));
+    instance->deactivate();
+
+    voiceInstances.push_back(std::move(instance));
+    freeIds.push_back(voiceId);
+  }
+
+  // pop order: lowest voice id first
+  std::reverse(freeIds.begin(), freeIds.end());
+  graph.commit();
   return id;
 }
 
@@ -37,7 +105,7 @@ std::vector<int> VoiceManager::instantiateNodes(int templateId) {
       // Create node and store id
       id = graph.addNode(ns.factory());
 
-    } else if (ns.syncMode == SyncMode::Shared) {
+    } else {
 
       // check if shared node already exists
       int sharedNodeId = sharedNodeIds[templateId][i];
@@ -53,87 +121,302 @@ std::vector<int> VoiceManager::instantiateNodes(int templateId) {
         id = sharedNodeId;
       }
     }
+    graph.getNodes()[id]->syncMode.store(ns.syncMode,
+                                         std::memory_order_relaxed);
     nodeIds.push_back(id);
   }
 
-  // add edges
+  // add edges; shared nodes gain one edge per voice reading them
   for (int i = 0; i < vt->edges().size(); i++) {
     const EdgeSpec &es = vt->edges()[i];
     int parentId = nodeIds[es.parentIdx];
     int childId = nodeIds[es.childIdx];
-    graph.addEdge(parentId, childId);
+    if (!graph.addEdge(parentId, childId))
+      std::cerr << "Voice template " << templateId << ": edge " << es.parentIdx
+                << " -> " << es.childIdx << " would create a cycle"
+                << std::endl;
   }
-  graph.sort();
 
   return nodeIds;
 }
 
-std::vector<ParamBinding> VoiceManager::instantiateParams(int templateId) {
-  // stores param kind for checking and pointer to relevant atomic
-  std::vector<ParamBinding> bindings;
+std::vector<ParamBinding>
+VoiceManager::instantiateParams(int templateId,
+                                const std::vector<int> &nodeIds) {
+  // one binding per dense paramId, pointing at the live parameter
+  const auto &specs = voiceTemplates[templateId]->params();
+  int count = 0;
+  for (const ParamSpec &ps : specs)
+    count = std::max(count, ps.paramId + 1);
+
+  std::vector<ParamBinding> bindings(count);
+  for (ParamBinding &binding : bindings)
+    binding.ptr.f = nullptr;
 
-  // IF param edit is within voice instance,  simply count nodes and
-  // look up param counts in table (e.g. osc = 3), adding them
-  // until reaching desired param id. perhaps do ParamKind : int
-  // then look up desired atomic in bindings table by count id
-  //
-  // IF param edit is for a node defined outside voice, simply
-  // look up the voice instances using that node and do the above
+  for (const ParamSpec &ps : specs) {
+    if (ps.paramId < 0 || ps.nodeIdx < 0 ||
+        ps.nodeIdx >= static_cast<int>(nodeIds.size()))
+      continue;
+    Node *node = graph.getNodes()[nodeIds[ps.nodeIdx]].get();
+    ParamBinding &binding = bindings[ps.paramId];
+    binding.kind = ps.kind;
+
+    auto *source = dynamic_cast<SourceNode *>(node);
+    auto *osc = dynamic_cast<Oscillator *>(node);
+    auto *lfo = dynamic_cast<LFO *>(node);
+    auto *filter = dynamic_cast<Filter *>(node);
+
+    switch (ps.kind) {
+    case ParamKind::OscFreq:
+      binding.ptr.f = source ? &source->freq : nullptr;
+      break;
+    case ParamKind::OscAmp:
+      binding.ptr.f = source ? &source->amp : nullptr;
+      break;
+    case ParamKind::OscWaveform:
+      binding.ptr.w = osc ? &osc->type : nullptr;
+      break;
+    case ParamKind::LfoBase:
+      binding.ptr.f = lfo ? &lfo->base : nullptr;
+      break;
+    case ParamKind::LfoAmp:
+      binding.ptr.f = lfo ? &lfo->amp : nullptr;
+      break;
+    case ParamKind::LfoFreq:
+      binding.ptr.f = lfo ? &lfo->freq : nullptr;
+      break;
+    case ParamKind::LfoShift:
+      binding.ptr.f = lfo ? &lfo->shift : nullptr;
+      break;
+    case ParamKind::LfoWaveform:
+      binding.ptr.w = lfo ? &lfo->type : nullptr;
+      break;
+    case ParamKind::FilterCutoff:
+      binding.ptr.f = filter ? &filter->cutoff : nullptr;
+      break;
+    case ParamKind::FilterQ:
+      binding.ptr.f = filter ? &filter->q : nullptr;
+      break;
+    }
+
+    if (!binding.ptr.f)
+      std::cerr << "Voice template " << templateId << ": param "
+                << ps.paramId << " does not match node " << ps.nodeIdx
+                << std::endl;
+  }
 
   return bindings;
 }
 
-int VoiceManager::allocateVoice(int templateId) {
-  if (freeVoiceIds.empty())
-    return -1;
-  if (templateId < 0 || templateId >= static_cast<int>(voiceTemplates.size()))
-    return -1;
+void VoiceManager::setStealPolicy(StealPolicy policy) {
+  stealPolicy.store(policy, std::memory_order_relaxed);
+}
 
-  int voiceId = freeVoiceIds.front();
-  freeVoiceIds.pop();
+StealPolicy VoiceManager::getStealPolicy() const {
+  return stealPolicy.load(std::memory_order_relaxed);
+}
 
-  auto instance = std::make_unique<VoiceInstance>();
-  instance->setIds(voiceId, templateId);
-  instance->setState(VoiceState::Active);
+void VoiceManager::setVoiceCap(int voices) {
+  voiceCap.store(std::max(0, voices), std::memory_order_relaxed);
+}
 
-  // create nodes according to specs
-  std::vector<int> nodeIds = instantiateNodes(templateId);
+int VoiceManager::getVoiceCap() const {
+  return voiceCap.load(std::memory_order_relaxed);
+}
 
-  // create and store param bindings
-  std::vector<ParamBinding> bindings = instantiateParams(templateId);
+int VoiceManager::getVoiceLimit() const {
+  return voiceLimit.load(std::memory_order_relaxed);
+}
 
-  instance->setNodeIds(std::move(nodeIds));
-  instance->setBindings(std::move(bindings));
-  voiceInstances[voiceId] = std::move(instance);
+int VoiceManager::limit() const {
+  int n = static_cast<int>(voiceInstances.size());
+  int cap = voiceCap.load(std::memory_order_relaxed);
+  if (cap > 0)
+    n = std::min(n, cap);
+  int governed = voiceLimit.load(std::memory_order_relaxed);
+  if (governed > 0)
+    n = std::min(n, governed);
+  return n;
+}
 
+int VoiceManager::pickVictim(StealPolicy policy, int templateId,
+                             float pitch) const {
+  int victim = -1;
+  float quietest = 0.0f;
+  for (int id = 0; id < static_cast<int>(voiceInstances.size()); id++) {
+    const VoiceInstance &v = *voiceInstances[id];
+    if (v.getState() == VoiceState::Inactive ||
+        (templateId >= 0 && v.getTemplateId() != templateId))
+      continue;
+    if (policy == StealPolicy::SamePitch &&
+        std::fabs(v.getPitch() - pitch) <= 1e-4f * std::fabs(pitch))
+      return id;
+    if (policy == StealPolicy::Quietest) {
+      float level = v.level();
+      if (victim < 0 || level < quietest) {
+        victim = id;
+        quietest = level;
+      }
+    } else if (victim < 0 ||
+               v.getStartedAt() < voiceInstances[victim]->getStartedAt()) {
+      victim = id;
+    }
+  }
+  return victim;
+}
+
+int VoiceManager::allocateVoice(int templateId, float pitch) {
+  if (templateId < 0 || templateId >= static_cast<int>(voiceTemplates.size()))
+    return -1;
+  std::vector<int> &freeIds = freeVoiceIds[templateId];
+  if (freeIds.empty() || activeVoices >= limit()) {
+    StealPolicy policy = stealPolicy.load(std::memory_order_relaxed);
+    if (policy == StealPolicy::None)
+      return -1;
+    // an empty pool only gets a voice back from its own template
+    int victim =
+        pickVictim(policy, freeIds.empty() ? templateId : -1, pitch);
+    if (victim < 0)
+      return -1;
+    freeVoice(victim);
+  }
+
+  int voiceId = freeIds.back();
+  freeIds.pop_back();
+  voiceInstances[voiceId]->activate(++notes, pitch);
+  activeVoices++;
   return voiceId;
 }
 
 void VoiceManager::freeVoice(int voiceId) {
-  if (voiceId < 0 || voiceId >= maxVoices)
+  if (voiceId < 0 || voiceId >= static_cast<int>(voiceInstances.size()))
     return;
-
-  // Remove per voice nodes from graph (should sort per removal)
   VoiceInstance &instance = *voiceInstances[voiceId];
-  std::vector<std::unique_ptr<Node>> &nodes = graph.getNodes();
+  if (instance.getState() == VoiceState::Inactive)
+    return;
+
+  instance.deactivate();
+  freeVoiceIds[instance.getTemplateId()].push_back(voiceId);
+  activeVoices--;
+}
+
+void VoiceManager::releaseVoice(int voiceId, uint64_t note) {
+  if (voiceId < 0 || voiceId >= static_cast<int>(voiceInstances.size()))
+    return;
+  if (voiceInstances[voiceId]->getStartedAt() == note)
+    freeVoice(voiceId);
+}
 
-  for (int nodeId : instance.getNodeIds()) {
-    if (nodes[nodeId]->syncMode.load(std::memory_order_relaxed) ==
-        SyncMode::PerVoice) {
-      graph.removeNode(nodeId);
+void VoiceManager::freeAllVoices() {
+  for (int i = 0; i < static_cast<int>(voiceInstances.size()); ++i)
+    freeVoice(i);
+}
+
+void VoiceManager::governLoad(float callbackLoad) {
+  // a slow callback counts at once, recovery only once it has lasted
+  constexpr float RECOVERY = 0.02f;
+  if (callbackLoad > load)
+    load = callbackLoad;
+  else
+    load += (callbackLoad - load) * RECOVERY;
+
+  // governed apart from the cap, so lifting the cap needs no ramp
+  int total = static_cast<int>(voiceInstances.size());
+  int governed = voiceLimit.load(std::memory_order_relaxed);
+  if (governed <= 0)
+    governed = total;
+
+  if (cutHold > 0)
+    cutHold--;
+  if (load > LOAD_HIGH) {
+    // A cut that left the load where it was means the cost is not in the
+    // voices (a heavy chain or bank): cutting on would only ratchet the
+    // limit down, so wait until the load falls again.
+    bool futile = loadAtCut > 0.0f && load >= loadAtCut;
+    // voices of a patch cost much the same each: scale their number so the
+    // load lands on the target, and expect it to follow
+    int keep = static_cast<int>(std::lround(activeVoices * LOAD_TARGET / load));
+    keep = std::max(1, keep);
+    if (cutHold == 0 && !futile && keep < activeVoices) {
+      loadAtCut = load;
+      load *= static_cast<float>(keep) / activeVoices;
+      governed = keep;
+      cutHold = RAISE_INTERVAL; // let the cut show in the load first
+    }
+    raiseCountdown = RAISE_INTERVAL;
+  } else if (load < LOAD_LOW) {
+    loadAtCut = 0.0f;
+    if (governed < total && --raiseCountdown <= 0) {
+      governed++;
+      raiseCountdown = RAISE_INTERVAL;
     }
   }
+  governed = std::min(governed, total);
+  voiceLimit.store(governed, std::memory_order_relaxed);
 
-  voiceInstances[voiceId].reset();
-  freeVoiceIds.push(voiceId);
+  // shed down to the limit, least missed first
+  StealPolicy policy = stealPolicy.load(std::memory_order_relaxed);
+  if (policy != StealPolicy::Quietest)
+    policy = StealPolicy::Oldest;
+  while (activeVoices > limit()) {
+    int victim = pickVictim(policy, -1, 0.0f);
+    if (victim < 0)
+      break;
+    freeVoice(victim);
+  }
 }
 
-void VoiceManager::freeAllVoices() {
-  while (!freeVoiceIds.empty())
-    freeVoiceIds.pop();
+void VoiceManager::setParam(int voiceId, int paramId, float value) {
+  if (voiceId < 0 || voiceId >= static_cast<int>(voiceInstances.size()))
+    return;
+  const auto &bindings = voiceInstances[voiceId]->getBindings();
+  if (paramId < 0 || paramId >= static_cast<int>(bindings.size()))
+    return;
 
-  for (int i = 0; i < maxVoices; ++i) {
-    voiceInstances[i].reset();
-    freeVoiceIds.push(i);
+  const ParamBinding &binding = bindings[paramId];
+  switch (binding.kind) {
+  case ParamKind::OscWaveform:
+  case ParamKind::LfoWaveform:
+    if (binding.ptr.w)
+      binding.ptr.w->store(static_cast<Waveform>(static_cast<int>(value)),
+                           std::memory_order_relaxed);
+    break;
+  default:
+    if (binding.ptr.f)
+      binding.ptr.f->set(value);
+    break;
+  }
+}
+
+void VoiceManager::handleEvent(const Event &event) {
+  switch (event.type) {
+  case NoteOn: {
+    int voiceId = allocateVoice(event.spawn.templateId, event.spawn.pitch);
+    if (voiceId < 0)
+      return;
+    // pitch (Hz) and velocity go to the voice's oscillators
+    const auto &bindings = voiceInstances[voiceId]->getBindings();
+    for (const ParamBinding &binding : bindings) {
+      if (!binding.ptr.f)
+        continue;
+      if (binding.kind == ParamKind::OscFreq)
+        binding.ptr.f->set(event.spawn.pitch);
+      else if (binding.kind == ParamKind::OscAmp)
+        binding.ptr.f->set(event.spawn.velocity);
+    }
+    break;
+  }
+  case NoteOff:
+    releaseVoice(event.release.voiceId, event.release.note);
+    break;
+  case SetParam:
+    setParam(event.setParam.voiceId, event.setParam.paramId,
+             event.setParam.value);
+    break;
+  case KillAll:
+    freeAllVoices();
+    break;
+  case SetValue:
+    break; // applied by the PatternEngine itself, never handed on
   }
 }
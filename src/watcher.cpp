@@ -0,0 +1,180 @@
+#include "watcher.h"
+
+#include <algorithm>
+#include <iostream>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr std::chrono::milliseconds POLL_INTERVAL{50};
+
+fs::path normalize(const fs::path &p) {
+  std::error_code ec;
+  fs::path abs = fs::absolute(p, ec);
+  return (ec ? p : abs).lexically_normal();
+}
+
+fs::file_time_type stampOf(const fs::path &p) {
+  std::error_code ec;
+  auto t = fs::last_write_time(p, ec);
+  return ec ? fs::file_time_type::min() : t;
+}
+
+} // namespace
+
+FileWatcher::FileWatcher(std::function<void()> onChange_)
+    : onChange(std::move(onChange_)) {
+#ifdef __linux__
+  inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotifyFd >= 0 && pipe2(wakeFds, O_CLOEXEC) != 0) {
+    close(inotifyFd);
+    inotifyFd = -1;
+  }
+  if (inotifyFd < 0)
+    std::cerr << "inotify unavailable, polling for changes" << std::endl;
+  if (inotifyFd >= 0) {
+    thread = std::thread(&FileWatcher::runNotify, this);
+    return;
+  }
+#endif
+  thread = std::thread(&FileWatcher::runPolling, this);
+}
+
+FileWatcher::~FileWatcher() {
+  quit.store(true);
+#ifdef __linux__
+  if (wakeFds[1] >= 0) {
+    char c = 0;
+    (void)write(wakeFds[1], &c, 1);
+  }
+#endif
+  if (thread.joinable())
+    thread.join();
+#ifdef __linux__
+  if (inotifyFd >= 0) {
+    close(inotifyFd);
+    close(wakeFds[0]);
+    close(wakeFds[1]);
+  }
+#endif
+}
+
+void FileWatcher::setFiles(const std::vector<fs::path> &paths) {
+  std::lock_guard<std::mutex> lock(mutex);
+  files.clear();
+  for (const fs::path &p : paths) {
+    fs::path file = normalize(p);
+    files.insert(file);
+    if (!stamps.count(file))
+      stamps[file] = stampOf(file);
+
+#ifdef __linux__
+    if (inotifyFd < 0)
+      continue;
+    // Watch the directory rather than the file: a save by rename replaces
+    // the file's inode, which would end a watch on the file itself.
+    fs::path dir = file.parent_path();
+    if (std::any_of(directories.begin(), directories.end(),
+                    [&dir](const auto &entry) { return entry.second == dir; }))
+      continue;
+    int wd = inotify_add_watch(inotifyFd, dir.c_str(),
+                               IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0)
+      std::cerr << "Cannot watch " << dir << std::endl;
+    else
+      directories[wd] = dir;
+#endif
+  }
+}
+
+void FileWatcher::runNotify() {
+#ifdef __linux__
+  using clock = std::chrono::steady_clock;
+  alignas(inotify_event) char buffer[4096];
+  bool pending = false;
+  clock::time_point due;
+
+  while (!quit.load()) {
+    int timeout = -1;
+    if (pending) {
+      auto wait = std::chrono::ceil<std::chrono::milliseconds>(due -
+                                                               clock::now());
+      timeout = static_cast<int>(std::max<long long>(0, wait.count()));
+    }
+    pollfd fds[2] = {{inotifyFd, POLLIN, 0}, {wakeFds[0], POLLIN, 0}};
+    int ready = poll(fds, 2, timeout);
+    if (quit.load())
+      break;
+
+    if (ready > 0 && (fds[0].revents & POLLIN)) {
+      // only whole writes are reported (close after write, rename into
+      // place), never a half-written file
+      ssize_t len = read(inotifyFd, buffer, sizeof(buffer));
+      std::lock_guard<std::mutex> lock(mutex);
+      for (ssize_t at = 0; at < len;) {
+        auto *event = reinterpret_cast<const inotify_event *>(buffer + at);
+        at += sizeof(inotify_event) + event->len;
+        auto dir = directories.find(event->wd);
+        if (event->len == 0 || dir == directories.end())
+          continue;
+        if (files.count(dir->second / event->name)) {
+          // editors write in bursts: wait for them to settle
+          pending = true;
+          due = clock::now() + DEBOUNCE;
+        }
+      }
+      continue;
+    }
+
+    if (pending && clock::now() >= due) {
+      pending = false;
+      onChange();
+    }
+  }
+#endif
+}
+
+void FileWatcher::runPolling() {
+  while (!quit.load()) {
+    std::this_thread::sleep_for(POLL_INTERVAL);
+
+    // report once a changed file has kept its time for a whole interval
+    bool changed = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (const fs::path &file : files) {
+        auto stamp = stampOf(file);
+        if (stamp != stamps[file]) {
+          stamps[file] = stamp;
+          changed = true;
+        }
+      }
+    }
+    if (!changed)
+      continue;
+    while (!quit.load()) {
+      std::this_thread::sleep_for(POLL_INTERVAL);
+      bool settled = true;
+      std::lock_guard<std::mutex> lock(mutex);
+      for (const fs::path &file : files) {
+        auto stamp = stampOf(file);
+        if (stamp != stamps[file]) {
+          stamps[file] = stamp;
+          settled = false;
+        }
+      }
+      if (settled)
+        break;
+    }
+    if (!quit.load())
+      onChange();
+  }
+}
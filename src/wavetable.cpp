@@ -0,0 +1,187 @@
+#include "wavetable.h"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+constexpr double PI = 3.14159265358979323846;
+
+using Complex = std::complex<double>;
+
+// In-place iterative radix-2 FFT. `inverse` uses e^{+i} and does not scale.
+void fft(std::vector<Complex> &a, bool inverse) {
+  const size_t n = a.size();
+  for (size_t i = 1, j = 0; i < n; i++) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j)
+      std::swap(a[i], a[j]);
+  }
+
+  for (size_t len = 2; len <= n; len <<= 1) {
+    double angle = 2.0 * PI / len * (inverse ? 1.0 : -1.0);
+    Complex wlen(std::cos(angle), std::sin(angle));
+    for (size_t i = 0; i < n; i += len) {
+      Complex w(1.0);
+      for (size_t k = 0; k < len / 2; k++) {
+        Complex u = a[i + k];
+        Complex v = a[i + k + len / 2] * w;
+        a[i + k] = u + v;
+        a[i + k + len / 2] = u - v;
+        w *= wlen;
+      }
+    }
+  }
+}
+
+// Fourier series of the naive shapes in nodes.cpp, phase in [0, 2pi).
+void seriesFor(Waveform type, std::vector<float> &cosAmp,
+               std::vector<float> &sinAmp) {
+  const int maxHarmonic = Wavetable::SIZE / 2;
+  cosAmp.assign(maxHarmonic + 1, 0.0f);
+  sinAmp.assign(maxHarmonic + 1, 0.0f);
+
+  for (int h = 1; h <= maxHarmonic; h++) {
+    switch (type) {
+    case Waveform::Sine:
+      sinAmp[h] = h == 1 ? 1.0f : 0.0f;
+      break;
+    case Waveform::Saw:
+      sinAmp[h] = static_cast<float>(-2.0 / (PI * h));
+      break;
+    case Waveform::InvSaw:
+      sinAmp[h] = static_cast<float>(2.0 / (PI * h));
+      break;
+    case Waveform::Square:
+      sinAmp[h] = (h & 1) ? static_cast<float>(4.0 / (PI * h)) : 0.0f;
+      break;
+    case Waveform::Triangle:
+      cosAmp[h] =
+          (h & 1) ? static_cast<float>(8.0 / (PI * PI * h * h)) : 0.0f;
+      break;
+    }
+  }
+}
+
+constexpr int BUILTIN_COUNT = static_cast<int>(Waveform::Triangle) + 1;
+
+std::unique_ptr<Wavetable> builtins[BUILTIN_COUNT];
+std::once_flag builtinsOnce;
+
+std::mutex userMutex;
+std::map<std::vector<float>, std::unique_ptr<Wavetable>> userTables;
+
+} // namespace
+
+int Wavetable::levelFor(float increment) {
+  float x = std::fabs(increment) * SIZE;
+  if (!(x > 1.0f))
+    return 0;
+  int k = std::ilogb(x);
+  if (std::ldexp(1.0f, k) < x)
+    k++;
+  return std::min(k, LEVELS - 1);
+}
+
+void Wavetable::build(const std::vector<float> &cosAmp,
+                      const std::vector<float> &sinAmp, bool normalize) {
+  const int maxHarmonic = SIZE / 2;
+  std::vector<Complex> spectrum(SIZE);
+  float gain = 1.0f;
+
+  for (int k = 0; k < LEVELS; k++) {
+    int limit = maxHarmonic >> k;
+
+    std::fill(spectrum.begin(), spectrum.end(), Complex(0.0));
+    for (int h = 1; h <= limit && h < static_cast<int>(cosAmp.size()); h++) {
+      // x[n] = A cos + B sin  <=>  X[h] = (A - iB) / 2, X[N-h] = conj
+      // (the inverse transform is unscaled)
+      Complex c(cosAmp[h] * 0.5, -sinAmp[h] * 0.5);
+      spectrum[h] += c;
+      if (h != SIZE - h)
+        spectrum[SIZE - h] += std::conj(c);
+      else
+        spectrum[h] = Complex(cosAmp[h]);
+    }
+    fft(spectrum, true);
+
+    float *table = data.data() + k * STRIDE + 1;
+    for (int n = 0; n < SIZE; n++)
+      table[n] = static_cast<float>(spectrum[n].real());
+
+    if (k == 0 && normalize) {
+      float peak = 0.0f;
+      for (int n = 0; n < SIZE; n++)
+        peak = std::max(peak, std::fabs(table[n]));
+      gain = peak > 0.0f ? 1.0f / peak : 1.0f;
+    }
+    for (int n = 0; n < SIZE; n++)
+      table[n] *= gain;
+
+    // wrap-around guards for interpolation
+    table[-1] = table[SIZE - 1];
+    table[SIZE] = table[0];
+    table[SIZE + 1] = table[1];
+    table[SIZE + 2] = table[2];
+  }
+}
+
+void Wavetable::init() {
+  std::call_once(builtinsOnce, [] {
+    std::vector<float> cosAmp, sinAmp;
+    for (int w = 0; w < BUILTIN_COUNT; w++) {
+      seriesFor(static_cast<Waveform>(w), cosAmp, sinAmp);
+      builtins[w] = std::make_unique<Wavetable>();
+      builtins[w]->build(cosAmp, sinAmp, false);
+    }
+  });
+}
+
+const Wavetable &Wavetable::get(Waveform type) {
+  return *builtins[static_cast<int>(type)];
+}
+
+const Wavetable *Wavetable::fromCycle(const std::vector<float> &cycle) {
+  if (cycle.empty())
+    return nullptr;
+
+  std::lock_guard<std::mutex> lock(userMutex);
+  auto it = userTables.find(cycle);
+  if (it != userTables.end())
+    return it->second.get();
+
+  // resample the cycle to SIZE points (linear, wrapping)
+  std::vector<Complex> samples(SIZE);
+  const size_t m = cycle.size();
+  for (int n = 0; n < SIZE; n++) {
+    double x = static_cast<double>(n) * m / SIZE;
+    size_t i = static_cast<size_t>(x);
+    double frac = x - i;
+    double a = cycle[i % m], b = cycle[(i + 1) % m];
+    samples[n] = Complex(a + frac * (b - a));
+  }
+  fft(samples, false);
+
+  // X[h] = N/2 (A - iB); DC is dropped
+  const int maxHarmonic = SIZE / 2;
+  std::vector<float> cosAmp(maxHarmonic + 1, 0.0f);
+  std::vector<float> sinAmp(maxHarmonic + 1, 0.0f);
+  for (int h = 1; h < maxHarmonic; h++) {
+    cosAmp[h] = static_cast<float>(2.0 * samples[h].real() / SIZE);
+    sinAmp[h] = static_cast<float>(-2.0 * samples[h].imag() / SIZE);
+  }
+  cosAmp[maxHarmonic] = static_cast<float>(samples[maxHarmonic].real() / SIZE);
+
+  auto table = std::make_unique<Wavetable>();
+  table->build(cosAmp, sinAmp, true);
+  const Wavetable *result = table.get();
+  userTables.emplace(cycle, std::move(table));
+  return result;
+}
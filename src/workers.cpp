@@ -0,0 +1,159 @@
+#include "workers.h"
+
+#include <algorithm>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TAKYON_PAUSE() _mm_pause()
+#elif defined(__aarch64__)
+#define TAKYON_PAUSE() __asm__ __volatile__("yield")
+#else
+#define TAKYON_PAUSE() ((void)0)
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+
+// Spins before a worker parks; long enough to cover the gap between
+// consecutive blocks of one callback, short next to a device period.
+constexpr int SPIN_LIMIT = 20000;
+
+// Ask for real-time scheduling; without the privilege this quietly fails
+// and the worker stays a normal thread.
+void raisePriority(std::thread &thread) {
+#if defined(__unix__) || defined(__APPLE__)
+  sched_param param{};
+  param.sched_priority = sched_get_priority_max(SCHED_FIFO) - 1;
+  pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param);
+#else
+  (void)thread;
+#endif
+}
+
+} // namespace
+
+WorkerPool::~WorkerPool() {
+  quit.store(true);
+  {
+    std::lock_guard<std::mutex> lock(parkMutex);
+    parkSignal.notify_all();
+  }
+  for (std::thread &t : threads)
+    t.join();
+}
+
+void WorkerPool::setWorkers(int count) {
+  // spinning workers only help while each has a core of its own
+  int cores = static_cast<int>(std::thread::hardware_concurrency()); // 0: unknown
+  int limit = cores > 0 ? std::min(cores - 1, MAX_WORKERS) : MAX_WORKERS;
+  count = std::clamp(count, 0, limit);
+  while (static_cast<int>(threads.size()) < count) {
+    int self = static_cast<int>(threads.size()) + 1;
+    threads.emplace_back(&WorkerPool::workerLoop, this, self);
+    raisePriority(threads.back());
+  }
+  active.store(count, std::memory_order_relaxed);
+}
+
+void WorkerPool::run(const RenderPlan &p, int n) {
+  // controllers publish their blocks before anything reading them starts
+  const int numTasks = static_cast<int>(p.tasks.size());
+  runPhase(p, 0, p.controlTasks, n);
+  runPhase(p, p.controlTasks, numTasks - p.controlTasks, n);
+}
+
+void WorkerPool::runPhase(const RenderPlan &p, int first, int numTasks,
+                          int n) {
+  int workers = std::min(active.load(std::memory_order_relaxed), numTasks - 1);
+  if (workers <= 0) {
+    for (int i = first; i < first + numTasks; i++)
+      p.runTask(p.tasks[i], n);
+    return;
+  }
+
+  // Invalidate every queue first so no late worker can claim from the old
+  // job while the new one is being described, then publish.
+  const uint32_t gen = generation.load(std::memory_order_relaxed) + 1;
+  const int total = workers + 1;
+  for (int q = 0; q < total; q++) {
+    queues[q].next.store(static_cast<uint64_t>(gen) << 32);
+    queues[q].count.store((numTasks - q + total - 1) / total);
+    queues[q].offset = first + q;
+    queues[q].stride = total;
+  }
+  plan.store(&p);
+  frames.store(n);
+  participants.store(total);
+  remaining.store(numTasks);
+  generation.store(gen);
+
+  // No lock on the audio thread: a wake-up lost to a worker that is just
+  // parking only costs parallelism until its timed wait runs out.
+  if (parked.load() > 0)
+    parkSignal.notify_all();
+
+  work(0, gen);
+  while (remaining.load(std::memory_order_acquire) > 0)
+    TAKYON_PAUSE();
+}
+
+void WorkerPool::workerLoop(int self) {
+  RenderPlan::flushDenormals();
+  uint32_t seen = generation.load();
+  int idle = 0;
+  while (!quit.load(std::memory_order_relaxed)) {
+    uint32_t gen = generation.load();
+    if (gen == seen) {
+      if (++idle < SPIN_LIMIT) {
+        TAKYON_PAUSE();
+        continue;
+      }
+      // idle between callbacks: sleep until the next job is published
+      std::unique_lock<std::mutex> lock(parkMutex);
+      parked.fetch_add(1);
+      parkSignal.wait_for(lock, std::chrono::milliseconds(5), [&] {
+        return generation.load() != seen || quit.load();
+      });
+      parked.fetch_sub(1);
+      idle = 0;
+      continue;
+    }
+    seen = gen;
+    idle = 0;
+    if (self < participants.load())
+      work(self, gen);
+  }
+}
+
+void WorkerPool::work(int self, uint32_t gen) {
+  // own queue first, then steal from the others
+  const int total = participants.load();
+  const RenderPlan *p = plan.load();
+  const int n = frames.load();
+  for (int k = 0; k < total; k++) {
+    Queue &queue = queues[(self + k) % total];
+    int index;
+    while ((index = claim(queue, gen)) >= 0) {
+      p->runTask(p->tasks[queue.offset + index * queue.stride], n);
+      remaining.fetch_sub(1, std::memory_order_release);
+    }
+  }
+}
+
+int WorkerPool::claim(Queue &queue, uint32_t gen) {
+  uint64_t v = queue.next.load();
+  for (;;) {
+    if (static_cast<uint32_t>(v >> 32) != gen)
+      return -1;
+    int index = static_cast<int>(v & 0xffffffffu);
+    if (index >= queue.count.load())
+      return -1;
+    if (queue.next.compare_exchange_weak(v, v + 1))
+      return index;
+  }
+}